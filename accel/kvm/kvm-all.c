@@ -555,12 +555,132 @@ static void kvm_log_stop(MemoryListener *listener,
     }
 }
 
+/*
+ * A set of threads that split a job with the thread that submits it.
+ * The job gets the index of the worker and the number of workers, and
+ * kvm_worker_pool_run() returns once every worker is done.  The caller
+ * keeps whatever locks it holds (slots lock, BQL) for the duration, the
+ * workers act on its behalf.
+ */
+typedef void KVMWorkerFunc(void *opaque, unsigned int index, unsigned int n);
+
+typedef struct KVMWorker {
+    struct KVMWorkerPool *pool;
+    unsigned int index;
+    QemuThread thread;
+    QemuSemaphore start;
+} KVMWorker;
+
+typedef struct KVMWorkerPool {
+    unsigned int n;
+    KVMWorker *workers;
+    QemuSemaphore done;
+    KVMWorkerFunc *fn;
+    void *opaque;
+} KVMWorkerPool;
+
+static void *kvm_worker_thread(void *data)
+{
+    KVMWorker *w = data;
+    KVMWorkerPool *pool = w->pool;
+
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_wait(&w->start);
+        WITH_RCU_READ_LOCK_GUARD() {
+            pool->fn(pool->opaque, w->index, pool->n);
+        }
+        qemu_sem_post(&pool->done);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+static KVMWorkerPool *kvm_worker_pool_new(const char *name, unsigned int n)
+{
+    KVMWorkerPool *pool = g_new0(KVMWorkerPool, 1);
+    unsigned int i;
+
+    assert(n > 1);
+    pool->n = n;
+    pool->workers = g_new0(KVMWorker, n);
+    qemu_sem_init(&pool->done, 0);
+
+    /* Worker 0 is the submitting thread */
+    for (i = 1; i < n; i++) {
+        KVMWorker *w = &pool->workers[i];
+        g_autofree char *thread_name = g_strdup_printf("%s-%u", name, i);
+
+        w->pool = pool;
+        w->index = i;
+        qemu_sem_init(&w->start, 0);
+        qemu_thread_create(&w->thread, thread_name, kvm_worker_thread, w,
+                           QEMU_THREAD_DETACHED);
+    }
+
+    return pool;
+}
+
+static void kvm_worker_pool_run(KVMWorkerPool *pool, KVMWorkerFunc *fn,
+                                void *opaque)
+{
+    unsigned int i;
+
+    pool->fn = fn;
+    pool->opaque = opaque;
+    for (i = 1; i < pool->n; i++) {
+        qemu_sem_post(&pool->workers[i].start);
+    }
+    fn(opaque, 0, pool->n);
+    for (i = 1; i < pool->n; i++) {
+        qemu_sem_wait(&pool->done);
+    }
+}
+
+/*
+ * Below this many pages (1 GiB with 4 KiB pages) a slot bitmap is merged
+ * by the calling thread alone.
+ */
+#define KVM_DIRTY_SYNC_PARALLEL_PAGES (1 << 18)
+
+/* Merge the index-th of n word-aligned parts of the slot bitmap */
+static void kvm_slot_sync_dirty_pages_part(void *opaque, unsigned int index,
+                                           unsigned int n)
+{
+    KVMSlot *slot = opaque;
+    ram_addr_t pages = slot->memory_size / qemu_real_host_page_size();
+    ram_addr_t words = BITS_TO_LONGS(pages);
+    ram_addr_t first = words * index / n;
+    ram_addr_t last = words * (index + 1) / n;
+
+    if (first == last) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap + first,
+        slot->ram_start_offset +
+        first * BITS_PER_LONG * qemu_real_host_page_size(),
+        MIN(pages, last * BITS_PER_LONG) - first * BITS_PER_LONG);
+}
+
 /* get kvm's dirty pages bitmap and update qemu's */
 static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
 {
+    KVMState *s = kvm_state;
     ram_addr_t start = slot->ram_start_offset;
     ram_addr_t pages = slot->memory_size / qemu_real_host_page_size();
 
+    /*
+     * The dirty bitmaps of RAM are updated with atomic operations, so
+     * disjoint parts of a slot can be merged concurrently.
+     */
+    if (s->dirty_sync_pool && pages >= KVM_DIRTY_SYNC_PARALLEL_PAGES) {
+        kvm_worker_pool_run(s->dirty_sync_pool,
+                            kvm_slot_sync_dirty_pages_part, slot);
+        return;
+    }
+
     cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
 }
 
@@ -644,7 +764,12 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    /* Rings of different vCPUs may be reaped concurrently */
+    if (s->reaper.pool) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -717,6 +842,27 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+typedef struct KVMDirtyRingReapJob {
+    KVMState *s;
+    uint64_t *counts;
+} KVMDirtyRingReapJob;
+
+/* Each reaper takes the vCPUs whose index matches its own modulo n */
+static void kvm_dirty_ring_reap_part(void *opaque, unsigned int index,
+                                     unsigned int n)
+{
+    KVMDirtyRingReapJob *job = opaque;
+    uint64_t count = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index % n == index) {
+            count += kvm_dirty_ring_reap_one(job->s, cpu);
+        }
+    }
+    job->counts[index] = count;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -728,6 +874,20 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
+    } else if (s->reaper.pool) {
+        uint64_t counts[KVM_DIRTY_RING_REAPERS_MAX];
+        KVMDirtyRingReapJob job = { .s = s, .counts = counts };
+        unsigned int i;
+
+        /*
+         * KVM_RESET_DIRTY_RINGS below covers the rings of all vCPUs, so
+         * only the collection is split; the reset still happens once,
+         * before the slots lock publishes the bits.
+         */
+        kvm_worker_pool_run(s->reaper.pool, kvm_dirty_ring_reap_part, &job);
+        for (i = 0; i < s->reaper.nr_reapers; i++) {
+            total += counts[i];
+        }
     } else {
         CPU_FOREACH(cpu) {
             total += kvm_dirty_ring_reap_one(s, cpu);
@@ -1458,6 +1618,9 @@ static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    if (r->nr_reapers > 1) {
+        r->pool = kvm_worker_pool_new("kvm-reaper", r->nr_reapers);
+    }
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -2724,6 +2887,11 @@ static int kvm_init(MachineState *ms)
     s->memory_listener.listener.coalesced_io_add = kvm_coalesce_mmio_region;
     s->memory_listener.listener.coalesced_io_del = kvm_uncoalesce_mmio_region;
 
+    if (s->dirty_sync_threads > 1) {
+        s->dirty_sync_pool = kvm_worker_pool_new("kvm-dirty-sync",
+                                                 s->dirty_sync_threads);
+    }
+
     kvm_memory_listener_register(s, &s->memory_listener,
                                  &address_space_memory, 0, "kvm-memory");
     if (kvm_eventfds_allowed) {
@@ -3751,6 +3919,74 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->reaper.nr_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 1 || value > KVM_DIRTY_RING_REAPERS_MAX) {
+        error_setg(errp, "dirty-ring-reapers must be between 1 and %d.",
+                   KVM_DIRTY_RING_REAPERS_MAX);
+        return;
+    }
+
+    s->reaper.nr_reapers = value;
+}
+
+static void kvm_get_dirty_sync_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->dirty_sync_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_sync_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 1 || value > KVM_DIRTY_SYNC_THREADS_MAX) {
+        error_setg(errp, "dirty-sync-threads must be between 1 and %d.",
+                   KVM_DIRTY_SYNC_THREADS_MAX);
+        return;
+    }
+
+    s->dirty_sync_threads = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3763,6 +3999,8 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->reaper.nr_reapers = 1;
+    s->dirty_sync_threads = 1;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3809,6 +4047,18 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads collecting the KVM dirty rings (default: 1)");
+
+    object_class_property_add(oc, "dirty-sync-threads", "uint32",
+        kvm_get_dirty_sync_threads, kvm_set_dirty_sync_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-sync-threads",
+        "Number of threads merging KVM dirty bitmaps (default: 1)");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -18,6 +18,10 @@ void tb_flush(CPUState *cpu)
 {
 }
 
+void tb_direct_ram_watchpoint(CPUState *cpu, bool inserted)
+{
+}
+
 void tlb_set_dirty(CPUState *cpu, vaddr vaddr)
 {
 }
@@ -165,6 +165,10 @@ uint32_t curr_cflags(CPUState *cpu)
         cflags |= CF_NO_GOTO_TB;
     }
 
+    if (qemu_plugin_sample_off(cpu)) {
+        cflags |= CF_PLUGIN_OFF;
+    }
+
     return cflags;
 }
 
@@ -218,6 +222,7 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
                                           uint32_t cflags)
 {
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -234,7 +239,12 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
     desc.page_addr0 = phys_pc;
     h = tb_hash_func(phys_pc, (cflags & CF_PCREL ? 0 : pc),
                      flags, cs_base, cflags);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        /* Missed in the jump cache: keep its region from being evicted. */
+        tcg_region_touch(tb->tc.ptr);
+    }
+    return tb;
 }
 
 /* Might cause an exception, so have a longjmp destination ready */
@@ -292,6 +302,29 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
     return tb;
 }
 
+/*
+ * Translate the block at @pc after a lookup miss.  In user-mode all
+ * threads translate under mmap_lock, and threads of one process tend to
+ * miss on the same blocks at the same time; look again once we hold the
+ * lock rather than translating the block a second time.
+ */
+static TranslationBlock *tb_lookup_or_gen(CPUState *cpu, vaddr pc,
+                                          uint64_t cs_base, uint32_t flags,
+                                          uint32_t cflags)
+{
+    TranslationBlock *tb = NULL;
+
+    mmap_lock();
+#ifdef CONFIG_USER_ONLY
+    tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+#endif
+    if (tb == NULL) {
+        tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    }
+    mmap_unlock();
+    return tb;
+}
+
 static void log_cpu_exec(vaddr pc, CPUState *cpu,
                          const TranslationBlock *tb)
 {
@@ -594,9 +627,7 @@ void cpu_exec_step_atomic(CPUState *cpu)
 
         tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
         if (tb == NULL) {
-            mmap_lock();
-            tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-            mmap_unlock();
+            tb = tb_lookup_or_gen(cpu, pc, cs_base, flags, cflags);
         }
 
         cpu_exec_enter(cpu);
@@ -662,6 +693,7 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     tb_next->jmp_list_head = (uintptr_t)tb | n;
 
     qemu_spin_unlock(&tb_next->jmp_lock);
+    tcg_region_touch(tb_next->tc.ptr);
 
     qemu_log_mask(CPU_LOG_EXEC, "Linking TBs %p index %d -> %p\n",
                   tb->tc.ptr, n, tb_next->tc.ptr);
@@ -1001,9 +1033,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 CPUJumpCache *jc;
                 uint32_t h;
 
-                mmap_lock();
-                tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-                mmap_unlock();
+                tb = tb_lookup_or_gen(cpu, pc, cs_base, flags, cflags);
 
                 /*
                  * We add the TB in the virtual pc hash table
@@ -1032,6 +1062,14 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 last_tb = NULL;
             }
 #endif
+            /*
+             * Instrumented and uninstrumented code must stay apart, or a
+             * vCPU could keep running one variant after the sampling phase
+             * has changed.
+             */
+            if (last_tb && ((tb_cflags(last_tb) ^ cflags) & CF_PLUGIN_OFF)) {
+                last_tb = NULL;
+            }
             /* See if we can patch the calling TB. */
             if (last_tb) {
                 tb_add_jump(last_tb, tb_exit, tb);
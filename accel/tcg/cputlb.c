@@ -236,6 +236,12 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lpindex = 0;
+    desc->lpoverflow = false;
+    for (int i = 0; i < CPU_LPTLB_SIZE; i++) {
+        desc->lptlb[i].addr = -1;
+        desc->lptlb[i].mask = 0;
+    }
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -322,6 +328,21 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
+void tlb_large_page_counts(size_t *pfill, size_t *pflush)
+{
+    CPUState *cpu;
+    size_t fill = 0, flush = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        fill += qatomic_read(&env_tlb(env)->c.lp_fill_count);
+        flush += qatomic_read(&env_tlb(env)->c.lp_flush_count);
+    }
+    *pfill = fill;
+    *pflush = flush;
+}
+
 void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -491,13 +512,81 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Flush every subpage of the large page @lp_addr/@lp_mask from the
+ * fast and victim tlbs, whichever way is cheaper.
+ */
+static void tlb_flush_large_page_entries_locked(CPUArchState *env, int midx,
+                                                vaddr lp_addr, vaddr lp_mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    size_t n_entries = tlb_n_entries(f);
+    vaddr n_pages = (~lp_mask + 1) >> TARGET_PAGE_BITS;
+
+    if (n_pages <= n_entries) {
+        for (vaddr i = 0; i < n_pages; i++) {
+            vaddr page = lp_addr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_entries; i++) {
+            if (tlb_flush_entry_mask_locked(&f->table[i], lp_addr, lp_mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+
+    for (int k = 0; k < CPU_VTLB_SIZE; k++) {
+        if (tlb_flush_entry_mask_locked(&d->vtable[k], lp_addr, lp_mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+}
+
+/*
+ * Invalidate the large pages of @midx that overlap [@addr, @addr + @len).
+ * Return false if not every large page is known individually, in which
+ * case the caller must flush the whole mmu_idx instead.
+ */
+static bool tlb_flush_large_pages_locked(CPUArchState *env, int midx,
+                                         vaddr addr, vaddr len)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    vaddr last = addr + len - 1;
+
+    if (d->lpoverflow) {
+        return false;
+    }
+
+    for (int i = 0; i < CPU_LPTLB_SIZE; i++) {
+        CPUTLBLargePage *lp = &d->lptlb[i];
+
+        if (lp->mask && addr <= (lp->addr | ~lp->mask) && last >= lp->addr) {
+            tlb_debug("flushing large page midx %d (%016"
+                      VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+                      midx, lp->addr, lp->mask);
+            tlb_flush_large_page_entries_locked(env, midx, lp->addr, lp->mask);
+            lp->addr = -1;
+            lp->mask = 0;
+            qatomic_set(&env_tlb(env)->c.lp_flush_count,
+                        env_tlb(env)->c.lp_flush_count + 1);
+        }
+    }
+    return true;
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx, vaddr page)
 {
     vaddr lp_addr = env_tlb(env)->d[midx].large_page_addr;
     vaddr lp_mask = env_tlb(env)->d[midx].large_page_mask;
 
     /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
+    if ((page & lp_mask) == lp_addr &&
+        !tlb_flush_large_pages_locked(env, midx, page, TARGET_PAGE_SIZE)) {
         tlb_debug("forcing full flush midx %d (%016"
                   VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, lp_addr, lp_mask);
@@ -740,7 +829,8 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
      * Because large_page_mask contains all 1's from the msb,
      * we only need to test the end of the range.
      */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
+    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr &&
+        !tlb_flush_large_pages_locked(env, midx, addr, len)) {
         tlb_debug("forcing full flush midx %d ("
                   "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, d->large_page_addr, d->large_page_mask);
@@ -1084,14 +1174,84 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
+/*
+ * Record @full for the large page containing @addr in the lptlb, so that
+ * further subpages can be refilled from it and it can be flushed exactly.
+ */
+static void tlb_record_large_page(CPUArchState *env, int mmu_idx,
+                                  vaddr addr, uint64_t size,
+                                  const CPUTLBEntryFull *full)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    vaddr lp_mask = ~(vaddr)(size - 1);
+    vaddr lp_addr = addr & lp_mask;
+    CPUTLBLargePage *lp = NULL;
+
+    for (int i = 0; i < CPU_LPTLB_SIZE; i++) {
+        if (d->lptlb[i].addr == lp_addr && d->lptlb[i].mask == lp_mask) {
+            lp = &d->lptlb[i];
+            break;
+        }
+    }
+    if (lp == NULL) {
+        lp = &d->lptlb[d->lpindex++ % CPU_LPTLB_SIZE];
+        if (lp->mask) {
+            /* Evicting a live record: we no longer know every large page. */
+            d->lpoverflow = true;
+        }
+    }
+
+    lp->addr = lp_addr;
+    lp->mask = lp_mask;
+    lp->full = *full;
+    lp->full.phys_addr = (full->phys_addr & TARGET_PAGE_MASK)
+                         - (addr & ~lp_mask & TARGET_PAGE_MASK);
+}
+
+/*
+ * On a miss in both the fast and victim tlbs, refill a subpage of a large
+ * page recorded in the lptlb without calling the target's tlb_fill.
+ * The protections are those the target granted for the large page, so an
+ * access that needs more (e.g. a write that should set a dirty bit) still
+ * goes to the target.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, vaddr addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    int need = (access_type == MMU_DATA_STORE ? PAGE_WRITE :
+                access_type == MMU_INST_FETCH ? PAGE_EXEC : PAGE_READ);
+
+    for (int i = 0; i < CPU_LPTLB_SIZE; i++) {
+        CPUTLBLargePage *lp = &d->lptlb[i];
+
+        if ((addr & lp->mask) == lp->addr &&
+            (lp->full.prot & (need | PAGE_WRITE_INV)) == need) {
+            CPUTLBEntryFull full = lp->full;
+
+            full.phys_addr += addr & ~lp->mask & TARGET_PAGE_MASK;
+            tlb_set_page_full(cpu, mmu_idx, addr, &full);
+            qatomic_set(&env_tlb(env)->c.lp_fill_count,
+                        env_tlb(env)->c.lp_fill_count + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+   large pages.  If these are invalidated while not all of them are known
+   individually in the lptlb, trigger a full TLB flush.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               vaddr addr, uint64_t size)
+                               vaddr addr, uint64_t size,
+                               const CPUTLBEntryFull *full)
 {
     vaddr lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
     vaddr lp_mask = ~(size - 1);
 
+    tlb_record_large_page(env, mmu_idx, addr, size, full);
+
     if (lp_addr == (vaddr)-1) {
         /* No previous large page.  */
         lp_addr = addr;
@@ -1129,7 +1289,8 @@ static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
 /*
  * Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is only used by tlb_flush_page and to refill the other
+ * subpages of a large page from the lptlb.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1155,7 +1316,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
         sz = TARGET_PAGE_SIZE;
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
-        tlb_add_large_page(env, mmu_idx, addr, sz);
+        tlb_add_large_page(env, mmu_idx, addr, sz, full);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1333,6 +1494,10 @@ static void tlb_fill(CPUState *cpu, vaddr addr, int size,
 {
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1462,7 +1627,8 @@ static int probe_access_internal(CPUArchState *env, vaddr addr,
         if (!victim_tlb_hit(env, mmu_idx, index, access_type, page_addr)) {
             CPUState *cs = env_cpu(env);
 
-            if (!cs->cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cs->cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                            mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -1611,6 +1777,18 @@ void *tlb_vaddr_to_host(CPUArchState *env, abi_ptr addr,
     return flags ? NULL : host;
 }
 
+/*
+ * Pretranslation threads translate from a host pointer resolved by the
+ * vCPU and must not touch its TLB.  Abandon the speculative translation
+ * rather than filling or faulting on behalf of another thread.
+ */
+static inline void check_pretranslate_code_access(void)
+{
+    if (unlikely(tcg_ctx->pretranslate)) {
+        siglongjmp(tcg_ctx->jmp_trans, -4);
+    }
+}
+
 /*
  * Return a ram_addr_t for the virtual address for execution.
  *
@@ -1627,6 +1805,7 @@ tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env, vaddr addr,
     CPUTLBEntryFull *full;
     void *p;
 
+    check_pretranslate_code_access();
     (void)probe_access_internal(env, addr, 1, MMU_INST_FETCH,
                                 cpu_mmu_index(env, true), false,
                                 &p, &full, 0, false);
@@ -3196,24 +3375,32 @@ void cpu_st16_mmu(CPUArchState *env, abi_ptr addr, Int128 val,
 uint32_t cpu_ldub_code(CPUArchState *env, abi_ptr addr)
 {
     MemOpIdx oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
+
+    check_pretranslate_code_access();
     return do_ld1_mmu(env, addr, oi, 0, MMU_INST_FETCH);
 }
 
 uint32_t cpu_lduw_code(CPUArchState *env, abi_ptr addr)
 {
     MemOpIdx oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
+
+    check_pretranslate_code_access();
     return do_ld2_mmu(env, addr, oi, 0, MMU_INST_FETCH);
 }
 
 uint32_t cpu_ldl_code(CPUArchState *env, abi_ptr addr)
 {
     MemOpIdx oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
+
+    check_pretranslate_code_access();
     return do_ld4_mmu(env, addr, oi, 0, MMU_INST_FETCH);
 }
 
 uint64_t cpu_ldq_code(CPUArchState *env, abi_ptr addr)
 {
     MemOpIdx oi = make_memop_idx(MO_TEUQ, cpu_mmu_index(env, true));
+
+    check_pretranslate_code_access();
     return do_ld8_mmu(env, addr, oi, 0, MMU_INST_FETCH);
 }
 
@@ -0,0 +1,136 @@
+/*
+ * Direct RAM window for TCG loads
+ *
+ * With -accel tcg,direct-ram=on, the largest contiguous RAM range of the
+ * system address space is tracked here.  Frontends can then let loads
+ * through mmu indexes that map this range linearly (MMU off, physical
+ * or superpage accesses) read host memory after an inline bounds check,
+ * instead of going through the softmmu TLB; see tcg_set_direct_ram.
+ *
+ * Stores always use the TLB, which keeps dirty tracking and detection
+ * of self-modifying code intact.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "exec/address-spaces.h"
+#include "exec/memory.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+
+typedef struct DirectRAMWindow {
+    struct rcu_head rcu;
+    TCGDirectRAM ram;
+} DirectRAMWindow;
+
+/* The current window, published with RCU.  */
+static DirectRAMWindow *direct_ram_window;
+
+/* The window being computed by a memory transaction, under the BQL.  */
+static TCGDirectRAM direct_ram_next;
+
+/* Read watchpoints on any CPU; the window is unused while nonzero.  */
+static int direct_ram_read_watchpoints;
+
+static void direct_ram_begin(MemoryListener *listener)
+{
+    memset(&direct_ram_next, 0, sizeof(direct_ram_next));
+}
+
+static void direct_ram_region_add(MemoryListener *listener,
+                                  MemoryRegionSection *section)
+{
+    MemoryRegion *mr = section->mr;
+    uint64_t size = int128_get64(section->size);
+
+    if (!memory_region_is_ram(mr) || memory_region_is_ram_device(mr) ||
+        size <= direct_ram_next.size) {
+        return;
+    }
+
+    direct_ram_next.base = section->offset_within_address_space;
+    direct_ram_next.size = size;
+    direct_ram_next.host = (uintptr_t)memory_region_get_ram_ptr(mr) +
+                           section->offset_within_region;
+}
+
+static void direct_ram_commit(MemoryListener *listener)
+{
+    DirectRAMWindow *old = direct_ram_window;
+    DirectRAMWindow *new = NULL;
+
+    if (old ? !memcmp(&old->ram, &direct_ram_next, sizeof(TCGDirectRAM))
+            : direct_ram_next.size == 0) {
+        return;
+    }
+
+    if (direct_ram_next.size) {
+        new = g_new(DirectRAMWindow, 1);
+        new->ram = direct_ram_next;
+    }
+    qatomic_rcu_set(&direct_ram_window, new);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+
+    /* Translated code has the bounds of the old window built in.  */
+    if (first_cpu) {
+        tb_flush(first_cpu);
+    }
+}
+
+static MemoryListener direct_ram_listener = {
+    .name = "tcg-direct-ram",
+    .begin = direct_ram_begin,
+    .region_add = direct_ram_region_add,
+    .region_nop = direct_ram_region_add,
+    .commit = direct_ram_commit,
+};
+
+void direct_ram_init(void)
+{
+    memory_listener_register(&direct_ram_listener, &address_space_memory);
+}
+
+/*
+ * Called at the start of tb_gen_code.  Frontends then enable the window
+ * per mmu index with tcg_set_direct_ram.
+ */
+void direct_ram_prepare(CPUState *cpu)
+{
+    DirectRAMWindow *win;
+
+    RCU_READ_LOCK_GUARD();
+    win = qatomic_rcu_read(&direct_ram_window);
+
+    /*
+     * Read watchpoints are only noticed by the TLB, and the TB may be
+     * executed by any CPU, not just the one that translates it.
+     */
+    if (win && !qatomic_read(&direct_ram_read_watchpoints)) {
+        tcg_ctx->direct_ram = win->ram;
+    } else {
+        memset(&tcg_ctx->direct_ram, 0, sizeof(TCGDirectRAM));
+    }
+}
+
+void tb_direct_ram_watchpoint(CPUState *cpu, bool inserted)
+{
+    if (!inserted) {
+        qatomic_dec(&direct_ram_read_watchpoints);
+        return;
+    }
+
+    /*
+     * Translations started after the increment leave the window unused;
+     * the flush takes care of those that already have it built in.
+     */
+    if (qatomic_fetch_inc(&direct_ram_read_watchpoints) == 0 &&
+        qatomic_read(&direct_ram_window)) {
+        tb_flush(cpu);
+    }
+}
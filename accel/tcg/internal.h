@@ -72,9 +72,34 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
                               int cflags);
+
+#ifdef CONFIG_SOFTMMU
+TranslationBlock *tb_gen_code_pretranslate(CPUState *cpu, vaddr pc,
+                                           uint64_t cs_base, uint32_t flags,
+                                           int cflags, tb_page_addr_t phys_pc,
+                                           void *host_pc);
+void pretranslate_init(unsigned n_threads);
+void pretranslate_queue_successors(CPUState *cpu, const TranslationBlock *tb,
+                                   vaddr pc);
+void pretranslate_lock(void);
+void pretranslate_unlock(void);
+void dump_pretranslate_info(GString *buf);
+void dump_smc_info(GString *buf);
+void direct_ram_init(void);
+void direct_ram_prepare(CPUState *cpu);
+#else
+static inline void pretranslate_queue_successors(CPUState *cpu,
+                                                 const TranslationBlock *tb,
+                                                 vaddr pc) { }
+static inline void pretranslate_lock(void) { }
+static inline void pretranslate_unlock(void) { }
+static inline void direct_ram_prepare(CPUState *cpu) { }
+#endif
+
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_evict_cold_region(void);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
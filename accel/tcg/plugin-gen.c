@@ -41,6 +41,12 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline operations and conditional callbacks do not use a template: their
+ * shape depends on the operation, on whether they address a per-vCPU
+ * scoreboard, and on the condition. The empty marker only records where they
+ * go, and the ops are generated in place at injection time by pointing
+ * tcg_ctx->emit_before_op at the marker.
  */
 #include "qemu/osdep.h"
 #include "cpu.h"
@@ -66,7 +72,8 @@
  * plugin_cb_start TCG op args[]:
  * 0: enum plugin_gen_from
  * 1: enum plugin_gen_cb
- * 2: set to 1 for mem callback that is a write, 0 otherwise.
+ * 2: for mem callbacks, the qemu_plugin_meminfo_t of the access; else 0.
+ * 3: for mem inline callbacks, the TCGTemp holding the address; else 0.
  */
 
 enum plugin_gen_from {
@@ -98,6 +105,11 @@ void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 void *userdata)
 { }
 
+void HELPER(plugin_mem_buf_flush)(uint32_t cpu_index, void *buf)
+{
+    qemu_plugin_mem_buf_flush(buf, cpu_index);
+}
+
 static void gen_empty_udata_cb(void)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -112,24 +124,6 @@ static void gen_empty_udata_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
-/*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
- */
-static void gen_empty_inline_cb(void)
-{
-    TCGv_i64 val = tcg_temp_ebb_new_i64();
-    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
-
-    tcg_gen_movi_ptr(ptr, 0);
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
-}
-
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -163,9 +157,21 @@ static void gen_empty_mem_helper(void)
 }
 
 static void gen_plugin_cb_start(enum plugin_gen_from from,
-                                enum plugin_gen_cb type, unsigned wr)
+                                enum plugin_gen_cb type, unsigned info)
 {
-    tcg_gen_plugin_cb_start(from, type, wr);
+    tcg_gen_plugin_cb_start(from, type, info, 0);
+}
+
+/*
+ * Inline ops are generated from scratch; only mark their position.
+ * Memory markers also remember where the address is, for tracing.
+ */
+static void gen_inline_marker(enum plugin_gen_from from, unsigned info,
+                              TCGv_i64 addr)
+{
+    tcg_gen_plugin_cb_start(from, PLUGIN_GEN_CB_INLINE, info,
+                            addr ? tcgv_i64_arg(addr) : 0);
+    tcg_gen_plugin_cb_end();
 }
 
 static void gen_wrapped(enum plugin_gen_from from,
@@ -193,7 +199,7 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
-        gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_inline_marker(from, 0, NULL);
         break;
     default:
         g_assert_not_reached();
@@ -202,15 +208,11 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
 
 void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
 {
-    enum qemu_plugin_mem_rw rw = get_plugin_meminfo_rw(info);
-
-    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_MEM, rw);
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_MEM, info);
     gen_empty_mem_cb(addr, info);
     tcg_gen_plugin_cb_end();
 
-    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
-    gen_empty_inline_cb();
-    tcg_gen_plugin_cb_end();
+    gen_inline_marker(PLUGIN_GEN_FROM_MEM, info, addr);
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -274,19 +276,6 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -300,21 +289,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -378,25 +352,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -438,10 +393,7 @@ static bool op_ok(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
 
 static bool op_rw(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
 {
-    int w;
-
-    w = op->args[2];
-    return !!(cb->rw & (w + 1));
+    return !!(cb->rw & get_plugin_meminfo_rw(op->args[2]));
 }
 
 static void inject_cb_type(const GArray *cbs, TCGOp *begin_op,
@@ -479,10 +431,242 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
-static void
-inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
+static void gen_load_cpu_index(TCGv_i32 cpu_index)
+{
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+}
+
+/* Compute the address of @entry for the vCPU executing the code. */
+static void gen_plugin_u64_ptr(TCGv_ptr ptr, qemu_plugin_u64 entry)
+{
+    GArray *data = entry.score->data;
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+
+    /* Elements can be large (see plugin_mem_buf_new), multiply in full */
+    gen_load_cpu_index(cpu_index);
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_temp_free_i32(cpu_index);
+    tcg_gen_muli_ptr(ptr, ptr, g_array_get_element_size(data));
+
+    /*
+     * The scoreboard is only reallocated with all vCPUs stopped, and the
+     * TB cache is flushed afterwards, so the base can be a constant.
+     */
+    tcg_gen_addi_ptr(ptr, ptr, (intptr_t)data->data + entry.offset);
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val;
+
+    if (cb->inline_insn.entry.score) {
+        gen_plugin_u64_ptr(ptr, cb->inline_insn.entry);
+    } else {
+        tcg_gen_movi_ptr(ptr, (intptr_t)cb->userp);
+    }
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_ebb_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* NEVER and ALWAYS are resolved at registration time */
+        g_assert_not_reached();
+    }
+}
+
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGv_i32 cpu_index;
+    TCGOp *op;
+
+    gen_plugin_u64_ptr(ptr, cb->cond.entry);
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+
+    cpu_index = tcg_temp_ebb_new_i32();
+    gen_load_cpu_index(cpu_index);
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, tcg_constant_ptr(cb->userp));
+    tcg_temp_free_i32(cpu_index);
+
+    /* redirect the call from the empty helper to the plugin */
+    op = tcg_last_op();
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] =
+        (uintptr_t)cb->f.vcpu_udata;
+
+    gen_set_label(skip);
+}
+
+/* Append a record for the access at @marker to the trace buffer. */
+static void gen_mem_trace(const struct qemu_plugin_dyn_cb *cb,
+                          const TCGOp *marker)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    struct qemu_plugin_mem_buf *buf = cb->userp;
+    qemu_plugin_u64 entry = { .score = buf->score, .offset = 0 };
+    TCGv_i64 addr = temp_tcgv_i64(arg_temp(marker->args[3]));
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i32 used = tcg_temp_ebb_new_i32();
+    TCGv_i32 ofs = tcg_temp_ebb_new_i32();
+    intptr_t base = offsetof(struct plugin_mem_buf_entry, records);
+
+    gen_plugin_u64_ptr(ptr, entry);
+    tcg_gen_ld_i32(used, ptr, offsetof(struct plugin_mem_buf_entry, used));
+    tcg_gen_muli_i32(ofs, used, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_ext_i32_ptr(rec, ofs);
+    tcg_gen_add_ptr(rec, rec, ptr);
+    tcg_temp_free_i32(ofs);
+
+    tcg_gen_st_i64(addr, rec,
+                   base + offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->trace.pc), rec,
+                   base + offsetof(struct qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(marker->args[2]), rec,
+                   base + offsetof(struct qemu_plugin_mem_record, info));
+    tcg_temp_free_ptr(rec);
+
+    tcg_gen_addi_i32(used, used, 1);
+    tcg_gen_st_i32(used, ptr, offsetof(struct plugin_mem_buf_entry, used));
+    tcg_temp_free_i32(used);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Appending a record must not branch, since guest temps are live around
+ * memory accesses.  Instead make room at the start of the instruction for
+ * all the records it can append, flushing the buffer if needed.
+ *
+ * Several callbacks in @cbs may share a buffer; the room is reserved once,
+ * for all of them, when @first is the first of those.  The end of the
+ * reserved room is kept in the buffer, so that accesses made from helpers
+ * do not use it up; see plugin_mem_trace_append().
+ */
+static void gen_mem_trace_reserve(const GArray *cbs, guint first)
+{
+    struct qemu_plugin_dyn_cb *cb =
+        &g_array_index(cbs, struct qemu_plugin_dyn_cb, first);
+    struct qemu_plugin_mem_buf *buf = cb->userp;
+    qemu_plugin_u64 entry = { .score = buf->score, .offset = 0 };
+    TCGLabel *skip;
+    TCGv_ptr ptr;
+    TCGv_i32 used, cpu_index;
+    uint32_t n = 0;
+    guint i;
+
+    for (i = 0; i < cbs->len; i++) {
+        cb = &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        if (cb->userp != buf) {
+            continue;
+        }
+        if (i < first) {
+            return;
+        }
+        n += cb->trace.n;
+    }
+    if (n == 0) {
+        return;
+    }
+    tcg_debug_assert(n < buf->n_records);
+
+    skip = gen_new_label();
+    ptr = tcg_temp_ebb_new_ptr();
+    used = tcg_temp_ebb_new_i32();
+    gen_plugin_u64_ptr(ptr, entry);
+    tcg_gen_ld_i32(used, ptr, offsetof(struct plugin_mem_buf_entry, used));
+    tcg_gen_brcondi_i32(TCG_COND_LEU, used, buf->n_records - n, skip);
+    tcg_temp_free_i32(used);
+    tcg_temp_free_ptr(ptr);
+
+    cpu_index = tcg_temp_ebb_new_i32();
+    gen_load_cpu_index(cpu_index);
+    gen_helper_plugin_mem_buf_flush(cpu_index, tcg_constant_ptr(buf));
+    tcg_temp_free_i32(cpu_index);
+
+    gen_set_label(skip);
+
+    ptr = tcg_temp_ebb_new_ptr();
+    used = tcg_temp_ebb_new_i32();
+    gen_plugin_u64_ptr(ptr, entry);
+    tcg_gen_ld_i32(used, ptr, offsetof(struct plugin_mem_buf_entry, used));
+    tcg_gen_addi_i32(used, used, n);
+    tcg_gen_st_i32(used, ptr, offsetof(struct plugin_mem_buf_entry, reserved));
+    tcg_temp_free_i32(used);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Generate inline ops, then conditional callbacks, then memory trace
+ * code right before the marker at @begin_op; finally drop the marker.
+ */
+static void inject_inline_cb(const GArray *cbs, const GArray *cond_cbs,
+                             const GArray *trace_cbs, TCGOp *begin_op,
+                             op_ok_fn ok)
+{
+    int i;
+
+    tcg_ctx->emit_before_op = begin_op;
+
+    for (i = 0; cbs && i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (ok(begin_op, cb)) {
+            gen_inline_op(cb);
+        }
+    }
+    for (i = 0; cond_cbs && i < cond_cbs->len; i++) {
+        gen_cond_cb(&g_array_index(cond_cbs, struct qemu_plugin_dyn_cb, i));
+    }
+    for (i = 0; trace_cbs && i < trace_cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(trace_cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (begin_op->args[0] != PLUGIN_GEN_FROM_MEM) {
+            gen_mem_trace_reserve(trace_cbs, i);
+        } else if (ok(begin_op, cb)) {
+            gen_mem_trace(cb, begin_op);
+        }
+    }
+
+    tcg_ctx->emit_before_op = NULL;
+    rm_ops(begin_op);
 }
 
 static void
@@ -526,12 +710,13 @@ static void inject_mem_enable_helper(struct qemu_plugin_tb *ptb,
                                      struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -594,7 +779,8 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
-    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], ptb->cbs[PLUGIN_CB_COND],
+                     NULL, begin_op, op_ok);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -610,6 +796,8 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
     inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
+                     insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND],
+                     insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE],
                      begin_op, op_ok);
 }
 
@@ -623,11 +811,11 @@ static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
 static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
-    const GArray *cbs;
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
 
-    cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
-    inject_inline_cb(cbs, begin_op, op_rw);
+    inject_inline_cb(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], NULL,
+                     insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE],
+                     begin_op, op_rw);
 }
 
 static void plugin_gen_enable_mem_helper(struct qemu_plugin_tb *ptb,
@@ -698,6 +886,50 @@ static void pr_ops(void)
 #endif
 }
 
+/*
+ * Count the accesses each instruction may append to memory trace
+ * buffers, for gen_mem_trace_reserve().
+ */
+static void plugin_gen_count_mem_traces(struct qemu_plugin_tb *ptb)
+{
+    struct qemu_plugin_insn *insn = NULL;
+    TCGOp *op;
+    int insn_idx = -1;
+    size_t i, n = 0;
+
+    for (i = 0; i < ptb->n; i++) {
+        insn = g_ptr_array_index(ptb->insns, i);
+        n += insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE]->len;
+    }
+    if (likely(n == 0)) {
+        return;
+    }
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        GArray *cbs;
+
+        if (op->opc == INDEX_op_insn_start) {
+            insn_idx++;
+            continue;
+        }
+        if (op->opc != INDEX_op_plugin_cb_start ||
+            op->args[0] != PLUGIN_GEN_FROM_MEM ||
+            op->args[1] != PLUGIN_GEN_CB_INLINE) {
+            continue;
+        }
+        insn = g_ptr_array_index(ptb->insns, insn_idx);
+        cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_TRACE];
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (op_rw(op, cb)) {
+                cb->trace.n++;
+            }
+        }
+    }
+}
+
 static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
     TCGOp *op;
@@ -705,6 +937,15 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 
     pr_ops();
 
+    /*
+     * Ops generated from here on are inserted in the middle of the stream,
+     * where a temp freed by the translator could still be live in the ops
+     * that follow.  Make sure new temps are not recycled from those.
+     */
+    memset(tcg_ctx->free_temps, 0, sizeof(tcg_ctx->free_temps));
+
+    plugin_gen_count_mem_traces(plugin_tb);
+
     QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
         switch (op->opc) {
         case INDEX_op_insn_start:
@@ -794,12 +1035,41 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
     pr_ops();
 }
 
+/*
+ * Count down the TBs left in the current sampling phase (or, in time
+ * mode, until the phase is checked again), and once there are none make
+ * the vCPU leave the TB chain on the next TB entry, so that it looks up
+ * the other variant; see qemu_plugin_sample_off().
+ */
+static void gen_sample_countdown(void)
+{
+    TCGv_i32 left = tcg_temp_ebb_new_i32();
+    TCGLabel *skip = gen_new_label();
+
+    tcg_gen_ld_i32(left, cpu_env, -offsetof(ArchCPU, env) +
+                   offsetof(CPUState, plugin_sample_left));
+    tcg_gen_subi_i32(left, left, 1);
+    tcg_gen_st_i32(left, cpu_env, -offsetof(ArchCPU, env) +
+                   offsetof(CPUState, plugin_sample_left));
+    tcg_gen_brcondi_i32(TCG_COND_GT, left, 0, skip);
+    tcg_temp_free_i32(left);
+    tcg_gen_st16_i32(tcg_constant_i32(-1), cpu_env,
+                     offsetof(ArchCPU, neg.icount_decr.u16.high) -
+                     offsetof(ArchCPU, env));
+    gen_set_label(skip);
+}
+
 bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
                          bool mem_only)
 {
     bool ret = false;
 
-    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+    if (plugin_sampling != PLUGIN_SAMPLE_NONE) {
+        gen_sample_countdown();
+    }
+
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask) &&
+        !(tb_cflags(db->tb) & CF_PLUGIN_OFF)) {
         struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
         int i;
 
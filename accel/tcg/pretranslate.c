@@ -0,0 +1,344 @@
+/*
+ * Background pretranslation of likely successor TranslationBlocks
+ *
+ * When a vCPU translates a block, the same-page targets of its direct
+ * branches and its fall-through successor are queued for translation by
+ * a small pool of helper threads.  The results are published through the
+ * QHT like any other TB, so that by the time the vCPU gets there the code
+ * is usually ready and the translation stall disappears from its thread.
+ *
+ * Helper threads own a TCGContext but no TLB.  They therefore only ever
+ * translate from the host address of a RAM page already resolved by a
+ * vCPU; anything that would require a TLB lookup aborts the translation.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/qht.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "hw/core/cpu.h"
+#include "tcg/tcg.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal.h"
+
+/* Requests beyond this are dropped: stale predictions are worthless. */
+#define PRETRANSLATE_QUEUE_SIZE 256
+/* How many successor generations to follow from a vCPU translation. */
+#define PRETRANSLATE_MAX_DEPTH  4
+
+typedef struct PretranslateReq {
+    CPUState *cpu;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    tb_page_addr_t phys_pc;
+    unsigned depth;
+} PretranslateReq;
+
+typedef struct PretranslateThread {
+    QemuThread thread;
+    /*
+     * Held by the helper thread while it generates code.  Each helper
+     * has its own, so that they translate in parallel; do_tb_flush takes
+     * all of them, see pretranslate_lock().
+     */
+    QemuMutex gen_lock;
+} PretranslateThread;
+
+static struct {
+    unsigned n_threads;
+    PretranslateThread *threads;
+
+    /* Protects everything below.  */
+    QemuMutex lock;
+    QemuCond cond;
+    unsigned head;
+    unsigned count;
+    PretranslateReq queue[PRETRANSLATE_QUEUE_SIZE];
+
+    size_t max_count;
+    size_t queued;
+    size_t dropped;
+    size_t translated;
+    size_t present;
+    size_t aborted;
+    int64_t gen_time_ns;
+} pt;
+
+/* Generation of the request being translated by this helper thread. */
+static __thread unsigned pretranslate_depth;
+
+static bool pretranslate_enqueue(const PretranslateReq *req)
+{
+    bool ok;
+
+    qemu_mutex_lock(&pt.lock);
+    ok = pt.count < PRETRANSLATE_QUEUE_SIZE;
+    if (ok) {
+        unsigned idx = (pt.head + pt.count) % PRETRANSLATE_QUEUE_SIZE;
+
+        pt.queue[idx] = *req;
+        pt.count++;
+        pt.max_count = MAX(pt.max_count, pt.count);
+        pt.queued++;
+        qemu_cond_signal(&pt.cond);
+    } else {
+        pt.dropped++;
+    }
+    qemu_mutex_unlock(&pt.lock);
+    return ok;
+}
+
+static void pretranslate_queue_one(CPUState *cpu, const TranslationBlock *tb,
+                                   vaddr page_pc, vaddr pc)
+{
+    PretranslateReq req = {
+        .cpu = cpu,
+        .pc = pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb_cflags(tb),
+        .phys_pc = (tb_page_addr0(tb) & TARGET_PAGE_MASK) |
+                   (pc & ~TARGET_PAGE_MASK),
+        .depth = pretranslate_depth + 1,
+    };
+
+    /* Only the page the vCPU already resolved is usable without a TLB. */
+    if ((page_pc ^ pc) & TARGET_PAGE_MASK) {
+        return;
+    }
+
+    object_ref(OBJECT(cpu));
+    if (!pretranslate_enqueue(&req)) {
+        object_unref(OBJECT(cpu));
+    }
+}
+
+/*
+ * Called at the end of tb_gen_code for a newly published @tb starting
+ * at virtual address @pc.
+ */
+void pretranslate_queue_successors(CPUState *cpu, const TranslationBlock *tb,
+                                   vaddr pc)
+{
+    uint32_t cflags = tb_cflags(tb);
+    int i;
+
+    if (likely(pt.n_threads == 0) ||
+        pretranslate_depth >= PRETRANSLATE_MAX_DEPTH) {
+        return;
+    }
+
+    /*
+     * Only predict for ordinary blocks.  Anything else is the result of
+     * a one-off request by the vCPU (icount, watchpoints, single-step,
+     * I/O recompilation) and its successors would not be looked up with
+     * the same compile flags.
+     */
+    if (cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_MEMI_ONLY |
+                  CF_SINGLE_STEP | CF_NOIRQ | CF_USE_ICOUNT)) {
+        return;
+    }
+
+#ifdef CONFIG_PLUGIN
+    /* Translation callbacks must be delivered on the vCPU thread. */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return;
+    }
+#endif
+
+    for (i = 0; i < tcg_ctx->nb_goto_tb_dest; i++) {
+        if (tcg_ctx->goto_tb_dest[i] != pc) {
+            pretranslate_queue_one(cpu, tb, pc, tcg_ctx->goto_tb_dest[i]);
+        }
+    }
+
+    /* The fall-through successor, unless the block left the page. */
+    if (tb_page_addr1(tb) == -1) {
+        pretranslate_queue_one(cpu, tb, pc, pc + tb->size);
+    }
+}
+
+static bool pretranslate_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const PretranslateReq *req = d;
+
+    return (tb_cflags(tb) & CF_PCREL || tb->pc == req->pc) &&
+           tb_page_addr0(tb) == req->phys_pc &&
+           tb_page_addr1(tb) == -1 &&
+           tb->cs_base == req->cs_base &&
+           tb->flags == req->flags &&
+           tb_cflags(tb) == req->cflags;
+}
+
+static bool pretranslate_present(const PretranslateReq *req)
+{
+    uint32_t h = tb_hash_func(req->phys_pc,
+                              req->cflags & CF_PCREL ? 0 : req->pc,
+                              req->flags, req->cs_base, req->cflags);
+
+    return qht_lookup_custom(&tb_ctx.htable, req, h, pretranslate_cmp);
+}
+
+/* Must be called within an RCU critical section. */
+static void *pretranslate_host_addr(tb_page_addr_t phys_pc)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH(block) {
+        ram_addr_t offset = phys_pc - block->offset;
+
+        if (phys_pc >= block->offset && offset_in_ramblock(block, offset)) {
+            return ramblock_ptr(block, offset);
+        }
+    }
+    return NULL;
+}
+
+static void pretranslate_one(PretranslateThread *t, const PretranslateReq *req)
+{
+    TranslationBlock *tb = NULL;
+    bool present = false;
+    int64_t ti = 0;
+
+    qemu_mutex_lock(&t->gen_lock);
+    WITH_RCU_READ_LOCK_GUARD() {
+        void *host_pc;
+
+        present = pretranslate_present(req);
+        if (present) {
+            break;
+        }
+        host_pc = pretranslate_host_addr(req->phys_pc);
+        if (host_pc == NULL) {
+            break;
+        }
+
+        ti = get_clock();
+        pretranslate_depth = req->depth;
+        tb = tb_gen_code_pretranslate(req->cpu, req->pc, req->cs_base,
+                                      req->flags, req->cflags,
+                                      req->phys_pc, host_pc);
+        ti = get_clock() - ti;
+    }
+    qemu_mutex_unlock(&t->gen_lock);
+
+    qemu_mutex_lock(&pt.lock);
+    if (present) {
+        pt.present++;
+    } else if (tb) {
+        pt.translated++;
+        pt.gen_time_ns += ti;
+    } else {
+        pt.aborted++;
+    }
+    qemu_mutex_unlock(&pt.lock);
+}
+
+static void *pretranslate_thread_fn(void *arg)
+{
+    PretranslateThread *t = arg;
+
+    rcu_register_thread();
+    tcg_register_thread();
+    tcg_ctx->pretranslate = true;
+
+    while (true) {
+        PretranslateReq req;
+
+        qemu_mutex_lock(&pt.lock);
+        while (pt.count == 0) {
+            qemu_cond_wait(&pt.cond, &pt.lock);
+        }
+        req = pt.queue[pt.head];
+        pt.head = (pt.head + 1) % PRETRANSLATE_QUEUE_SIZE;
+        pt.count--;
+        qemu_mutex_unlock(&pt.lock);
+
+        pretranslate_one(t, &req);
+        object_unref(OBJECT(req.cpu));
+    }
+
+    return NULL;
+}
+
+/*
+ * Keep helper threads from generating code, e.g. while the code buffer
+ * is reset.  They are not vCPUs and do not take part in exclusive work.
+ */
+void pretranslate_lock(void)
+{
+    unsigned i;
+
+    /* Always in the same order; the helpers only ever take their own. */
+    for (i = 0; i < pt.n_threads; i++) {
+        qemu_mutex_lock(&pt.threads[i].gen_lock);
+    }
+}
+
+void pretranslate_unlock(void)
+{
+    unsigned i;
+
+    for (i = pt.n_threads; i-- > 0;) {
+        qemu_mutex_unlock(&pt.threads[i].gen_lock);
+    }
+}
+
+/* Called after tcg_prologue_init, before any vCPU thread is started. */
+void pretranslate_init(unsigned n_threads)
+{
+    unsigned i;
+
+    if (n_threads == 0) {
+        return;
+    }
+
+    qemu_mutex_init(&pt.lock);
+    qemu_cond_init(&pt.cond);
+    pt.threads = g_new0(PretranslateThread, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        qemu_mutex_init(&pt.threads[i].gen_lock);
+    }
+    pt.n_threads = n_threads;
+
+    for (i = 0; i < n_threads; i++) {
+        g_autofree char *name = g_strdup_printf("TCG pretrans %u", i);
+
+        qemu_thread_create(&pt.threads[i].thread, name,
+                           pretranslate_thread_fn, &pt.threads[i],
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+void dump_pretranslate_info(GString *buf)
+{
+    if (pt.n_threads == 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&pt.lock);
+    g_string_append_printf(buf, "\nPretranslation (%u threads):\n",
+                           pt.n_threads);
+    g_string_append_printf(buf, "queue depth         %u (max %zu/%d)\n",
+                           pt.count, pt.max_count, PRETRANSLATE_QUEUE_SIZE);
+    g_string_append_printf(buf, "requests queued     %zu (dropped %zu)\n",
+                           pt.queued, pt.dropped);
+    g_string_append_printf(buf, "TBs translated      %zu\n", pt.translated);
+    g_string_append_printf(buf, "already present     %zu\n", pt.present);
+    g_string_append_printf(buf, "aborted             %zu\n", pt.aborted);
+    g_string_append_printf(buf, "translation time    %" PRId64 " us "
+                           "(avg %" PRId64 " ns/TB)\n",
+                           pt.gen_time_ns / SCALE_US,
+                           pt.translated ?
+                           pt.gen_time_ns / (int64_t)pt.translated : 0);
+    qemu_mutex_unlock(&pt.lock);
+}
@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
+#include "qemu/rcu.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/exec-all.h"
@@ -30,6 +31,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "trace.h"
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -181,6 +183,12 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* guest writes that had to look for code on this page */
+    unsigned smc_writes;
+    /* incremented for each write that invalidated some of its TBs */
+    unsigned smc_epoch;
+    /* TBs invalidated by those writes */
+    unsigned smc_tbs;
 };
 
 void page_table_config_init(void)
@@ -764,6 +772,8 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
         goto done;
     }
+    /* Pretranslation threads are not vCPUs; keep them out of the way. */
+    pretranslate_lock();
     did_flush = true;
 
     CPU_FOREACH(cpu) {
@@ -776,6 +786,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
+    pretranslate_unlock();
 
 done:
     mmap_unlock();
@@ -874,28 +885,6 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
-static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
-{
-    CPUState *cpu;
-
-    if (tb_cflags(tb) & CF_PCREL) {
-        /* A TB may be at any virtual address */
-        CPU_FOREACH(cpu) {
-            tcg_flush_jmp_cache(cpu);
-        }
-    } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb->pc);
-
-        CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
-
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
-            }
-        }
-    }
-}
-
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
@@ -927,8 +916,13 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         tb_remove(tb);
     }
 
-    /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    /*
+     * Leave the TB in the vCPUs' jump caches: with CF_INVALID set it no
+     * longer matches any lookup there (see tb_lookup), and visiting every
+     * vCPU's cache on each invalidation does not scale.  The stale entries
+     * are dropped before the memory of the TB is reused, either by
+     * tb_flush or by tb_evict_rcu.
+     */
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -963,6 +957,74 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+typedef struct TBEviction {
+    struct rcu_head rcu;
+    size_t region;
+    unsigned epoch;
+} TBEviction;
+
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+static void tb_evict_rcu(TBEviction *ev)
+{
+    CPUState *cpu;
+
+    /*
+     * The jump caches may still hold evicted TBs: invalidation leaves
+     * them there, and a tb_lookup that ran concurrently with the eviction
+     * may have stored one just now.  Every such RCU critical section has
+     * ended by now, so drop the entries for good before the memory is
+     * reused.
+     */
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            tcg_flush_jmp_cache(cpu);
+        }
+    }
+    tcg_region_evict_end(ev->region, ev->epoch);
+    g_free(ev);
+}
+
+/*
+ * Invalidate all TBs of the coldest code region, so that it can be reused
+ * without a global tb_flush.  vCPUs run TBs inside an RCU read-side
+ * critical section (see cpu_exec), so the region is only handed out again
+ * after a grace period, when nobody can be executing from it any more.
+ * Called with mmap_lock held in user-mode.
+ */
+void tb_evict_cold_region(void)
+{
+    g_autoptr(GPtrArray) tbs = NULL;
+    TBEviction *ev;
+    unsigned epoch;
+    ssize_t idx;
+    guint i;
+
+    idx = tcg_region_evict_begin(&epoch);
+    if (idx < 0) {
+        return;
+    }
+
+    /* Page locks nest outside the region tree lock; collect the TBs first. */
+    tbs = g_ptr_array_new();
+    tcg_region_tb_foreach(idx, tb_evict_collect, tbs);
+    for (i = 0; i < tbs->len; i++) {
+        tb_phys_invalidate(g_ptr_array_index(tbs, i), -1);
+    }
+
+    qatomic_inc(&tb_ctx.tb_evict_count);
+    qatomic_add(&tb_ctx.tb_evict_tbs, tbs->len);
+
+    ev = g_new(TBEviction, 1);
+    ev->region = idx;
+    ev->epoch = epoch;
+    call_rcu(ev, tb_evict_rcu, rcu);
+}
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -1089,9 +1151,31 @@ bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc)
     return false;
 }
 #else
+/*
+ * Return true if the part of @tb on the page it is linked from through
+ * slot @n intersects [@start, @last].
+ */
+static bool tb_page_intersects(const TranslationBlock *tb, PageForEachNext n,
+                               tb_page_addr_t start, tb_page_addr_t last)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    return !(tb_last < start || tb_start > last);
+}
+
 /*
  * @p must be non-NULL.
- * Call with all @pages locked.
+ * Call with all @pages locked, or with only @p locked and @pages NULL if
+ * none of the TBs to invalidate spans another page.
  */
 static void
 tb_invalidate_phys_page_range__locked(struct page_collection *pages,
@@ -1101,6 +1185,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     PageForEachNext n;
+    unsigned n_invalidated = 0;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
     TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
@@ -1114,18 +1199,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
      * XXX: see if in some cases it could be faster to invalidate all the code
      */
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
-        tb_page_addr_t tb_start, tb_last;
-
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
-        } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
-        if (!(tb_last < start || tb_start > last)) {
+        if (tb_page_intersects(tb, n, start, last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
                 (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
@@ -1141,9 +1215,17 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
             tb_phys_invalidate__locked(tb);
+            n_invalidated++;
         }
     }
 
+    if (n_invalidated) {
+        p->smc_epoch++;
+        p->smc_tbs += n_invalidated;
+        trace_tb_invalidate_smc(start & TARGET_PAGE_MASK, p->smc_epoch,
+                                n_invalidated);
+    }
+
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
         tlb_unprotect_code(start);
@@ -1151,7 +1233,11 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
-        page_collection_unlock(pages);
+        if (pages) {
+            page_collection_unlock(pages);
+        } else {
+            page_unlock(p);
+        }
         /* Force execution of one insn next time.  */
         current_cpu->cflags_next_tb = 1 | CF_NOIRQ | curr_cflags(current_cpu);
         mmap_unlock();
@@ -1232,20 +1318,155 @@ static void tb_invalidate_phys_page_fast__locked(struct page_collection *pages,
     tb_invalidate_phys_page_range__locked(pages, p, start, start + len - 1, ra);
 }
 
+/*
+ * Return true if the TBs of @p that intersect [@start, @last] can be
+ * invalidated with just @p locked, i.e. none of them spans two pages.
+ * Call with @p locked.
+ */
+static bool tb_page_range_is_local(PageDesc *p, tb_page_addr_t start,
+                                   tb_page_addr_t last)
+{
+    TranslationBlock *tb;
+    PageForEachNext n;
+
+    PAGE_FOR_EACH_TB(start, last, p, tb, n) {
+        if (tb_page_addr1(tb) != -1 &&
+            ((tb_page_addr0(tb) ^ tb_page_addr1(tb)) & TARGET_PAGE_MASK) &&
+            tb_page_intersects(tb, n, start, last)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * len must be <= 8 and start must be a multiple of len.
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
+ *
+ * This is hot for guests that JIT-compile code, as they keep writing to
+ * pages holding code (often just data next to it).  Unless the write
+ * hits a TB that spans two pages, only the written page is locked: a
+ * full page_collection would lock the pages of all TBs on the page and
+ * make all vCPUs writing nearby serialize on each other.
  */
 void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr)
 {
+    tb_page_addr_t last = ram_addr + size - 1;
     struct page_collection *pages;
+    PageDesc *p;
 
-    pages = page_collection_lock(ram_addr, ram_addr + size - 1);
+    p = page_find(ram_addr >> TARGET_PAGE_BITS);
+    if (!p) {
+        return;
+    }
+
+    page_lock(p);
+    p->smc_writes++;
+    if (tb_page_range_is_local(p, ram_addr, last)) {
+        tb_invalidate_phys_page_range__locked(NULL, p, ram_addr, last,
+                                              retaddr);
+        page_unlock(p);
+        return;
+    }
+    page_unlock(p);
+
+    pages = page_collection_lock(ram_addr, last);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
     page_collection_unlock(pages);
 }
 
+#define SMC_TOP_PAGES 8
+
+typedef struct SMCPageStats {
+    tb_page_addr_t index;
+    unsigned writes;
+    unsigned epoch;
+    unsigned tbs;
+} SMCPageStats;
+
+typedef struct SMCStats {
+    uint64_t writes;
+    uint64_t epochs;
+    uint64_t tbs;
+    SMCPageStats top[SMC_TOP_PAGES];
+} SMCStats;
+
+static void tb_smc_stats_page(SMCStats *st, PageDesc *pd, tb_page_addr_t index)
+{
+    SMCPageStats ps = {
+        .index = index,
+        .writes = qatomic_read(&pd->smc_writes),
+        .epoch = qatomic_read(&pd->smc_epoch),
+        .tbs = qatomic_read(&pd->smc_tbs),
+    };
+    int i;
+
+    st->writes += ps.writes;
+    st->epochs += ps.epoch;
+    st->tbs += ps.tbs;
+
+    /* Keep the pages with the most invalidations, in decreasing order. */
+    if (ps.epoch <= st->top[SMC_TOP_PAGES - 1].epoch) {
+        return;
+    }
+    for (i = SMC_TOP_PAGES - 1; i > 0 && st->top[i - 1].epoch < ps.epoch; i--) {
+        st->top[i] = st->top[i - 1];
+    }
+    st->top[i] = ps;
+}
+
+static void tb_smc_stats_1(SMCStats *st, int level, void **lp,
+                           tb_page_addr_t prefix)
+{
+    int i;
+
+    if (*lp == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PageDesc *pd = *lp;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            tb_smc_stats_page(st, &pd[i], (prefix << V_L2_BITS) | i);
+        }
+    } else {
+        void **pp = *lp;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            tb_smc_stats_1(st, level - 1, pp + i, (prefix << V_L2_BITS) | i);
+        }
+    }
+}
+
+/*
+ * Report guest writes to pages holding translated code, and the pages
+ * on which they caused the most invalidations.  The counters are read
+ * without taking the page locks, so they are only approximately in sync.
+ */
+void dump_smc_info(GString *buf)
+{
+    SMCStats st = { };
+    int i, l1_sz = v_l1_size;
+
+    for (i = 0; i < l1_sz; i++) {
+        tb_smc_stats_1(&st, v_l2_levels, l1_map + i, i);
+    }
+
+    g_string_append_printf(buf, "\nSelf-modifying code:\n");
+    g_string_append_printf(buf, "writes to code pages %" PRIu64 "\n",
+                           st.writes);
+    g_string_append_printf(buf, "invalidating writes  %" PRIu64
+                           " (%" PRIu64 " TBs)\n", st.epochs, st.tbs);
+    for (i = 0; i < SMC_TOP_PAGES && st.top[i].epoch; i++) {
+        g_string_append_printf(buf, "  page 0x%" PRIx64 ": %u writes, "
+                               "%u invalidating, %u TBs\n",
+                               (uint64_t)st.top[i].index << TARGET_PAGE_BITS,
+                               st.top[i].writes, st.top[i].epoch,
+                               st.top[i].tbs);
+    }
+}
+
 #endif /* CONFIG_USER_ONLY */
@@ -47,6 +47,9 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t pretranslate;
+    bool direct_ram;
+    bool tb_evict;
 };
 typedef struct TCGState TCGState;
 
@@ -112,6 +115,18 @@ static int tcg_init_machine(MachineState *ms)
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
 
+#if defined(CONFIG_SOFTMMU)
+    /*
+     * Pretranslation threads need code_gen_buffer regions of their own,
+     * which are only carved out with MTTCG.
+     */
+    if (s->pretranslate && !mttcg_enabled) {
+        warn_report("pretranslate requires thread=multi, disabling it");
+        s->pretranslate = 0;
+    }
+    max_cpus += s->pretranslate;
+#endif
+
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
@@ -122,6 +137,18 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+    pretranslate_init(s->pretranslate);
+    if (s->direct_ram) {
+        direct_ram_init();
+    }
+    if (s->tb_evict) {
+        /* With a single region there is nothing to choose from. */
+        if (!mttcg_enabled) {
+            warn_report("tb-evict requires thread=multi, disabling it");
+        } else {
+            tcg_region_enable_eviction();
+        }
+    }
 #endif
 
     return 0;
@@ -181,6 +208,60 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_pretranslate(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->pretranslate;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_pretranslate(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 64) {
+        error_setg(errp, "pretranslate must be at most 64 threads");
+        return;
+    }
+
+    s->pretranslate = value;
+}
+
+static bool tcg_get_direct_ram(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->direct_ram;
+}
+
+static void tcg_set_direct_ram(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->direct_ram = value;
+}
+
+static bool tcg_get_tb_evict(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_evict;
+}
+
+static void tcg_set_tb_evict(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_evict = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -240,6 +321,26 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add(oc, "pretranslate", "int",
+        tcg_get_pretranslate, tcg_set_pretranslate,
+        NULL, NULL);
+    object_class_property_set_description(oc, "pretranslate",
+        "Number of threads translating likely successor blocks ahead "
+        "of the vCPUs (0 disables)");
+
+    object_class_property_add_bool(oc, "direct-ram",
+        tcg_get_direct_ram, tcg_set_direct_ram);
+    object_class_property_set_description(oc, "direct-ram",
+        "Let identity-mapped loads from RAM bypass the softmmu TLB");
+
+    object_class_property_add_bool(oc, "tb-evict",
+        tcg_get_tb_evict, tcg_set_tb_evict);
+    object_class_property_set_description(oc, "tb-evict",
+        "Evict cold code regions instead of flushing the whole "
+        "translation cache when it fills up");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -283,28 +283,23 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Translate the block at @pc, whose first page has already been resolved
+ * to @phys_pc and @host_pc.  Returns NULL only for pretranslation threads,
+ * which abandon the block instead of flushing or touching the TLB.
+ */
+static TranslationBlock *tb_gen_code_common(CPUState *cpu,
+                                            vaddr pc, uint64_t cs_base,
+                                            uint32_t flags, int cflags,
+                                            tb_page_addr_t phys_pc,
+                                            void *host_pc)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
-    tb_page_addr_t phys_pc, phys_p2;
+    tb_page_addr_t phys_p2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
     int64_t ti;
-    void *host_pc;
-
-    assert_memory_lock();
-    qemu_thread_jit_write();
-
-    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
-
-    if (phys_pc == -1) {
-        /* Generate a one-shot TB with 1 insn in it */
-        cflags = (cflags & ~CF_COUNT_MASK) | CF_LAST_IO | 1;
-    }
 
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
@@ -312,10 +307,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     QEMU_BUILD_BUG_ON(CF_COUNT_MASK + 1 != TCG_MAX_INSNS);
 
+    /* Make room before we get to the point of flushing everything. */
+    if (unlikely(tcg_region_evict_wanted()) && !tcg_ctx->pretranslate) {
+        tb_evict_cold_region();
+    }
+
  buffer_overflow:
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
+        if (tcg_ctx->pretranslate) {
+            /* Leave the flush to the next vCPU that needs the space. */
+            return NULL;
+        }
         /* flush must be done */
         tb_flush(cpu);
         mmap_unlock();
@@ -353,9 +357,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 #else
     tcg_ctx->guest_mo = TCG_MO_ALL;
 #endif
+    direct_ram_prepare(cpu);
 
  restart_translate:
     trace_translate_block(tb, pc, tb->tc.ptr);
+    tcg_ctx->nb_goto_tb_dest = 0;
+    tcg_ctx->direct_ram_idxmap = 0;
 
     gen_code_size = setjmp_gen_code(env, tb, pc, host_pc, &max_insns, &ti);
     if (unlikely(gen_code_size < 0)) {
@@ -417,6 +424,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           "Restarting code generation with re-locked pages");
             goto restart_translate;
 
+        case -4:
+            /*
+             * A pretranslation thread needed a TLB lookup, either for a
+             * second page or for an MMIO fallback.  Only the owning vCPU
+             * may do that, so drop the block and give back its space.
+             */
+            tb_unlock_pages(tb);
+            tcg_ctx->gen_tb = NULL;
+            qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
+                        ((uintptr_t)gen_code_buf -
+                         ROUND_UP(sizeof(*tb), qemu_icache_linesize)));
+            return NULL;
+
         default:
             g_assert_not_reached();
         }
@@ -562,9 +582,54 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+
+    pretranslate_queue_successors(cpu, tb, pc);
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu->env_ptr;
+    tb_page_addr_t phys_pc;
+    void *host_pc;
+
+    assert_memory_lock();
+    qemu_thread_jit_write();
+
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+
+    if (phys_pc == -1) {
+        /* Generate a one-shot TB with 1 insn in it */
+        cflags = (cflags & ~CF_COUNT_MASK) | CF_LAST_IO | 1;
+    }
+
+    return tb_gen_code_common(cpu, pc, cs_base, flags, cflags,
+                              phys_pc, host_pc);
+}
+
+#ifdef CONFIG_SOFTMMU
+/*
+ * Called from a pretranslation thread, with the first page of the block
+ * already resolved.  Returns NULL if the block could not be translated
+ * without help from the vCPU.
+ */
+TranslationBlock *tb_gen_code_pretranslate(CPUState *cpu,
+                                           vaddr pc, uint64_t cs_base,
+                                           uint32_t flags, int cflags,
+                                           tb_page_addr_t phys_pc,
+                                           void *host_pc)
+{
+    tcg_debug_assert(tcg_ctx->pretranslate);
+    qemu_thread_jit_write();
+
+    return tb_gen_code_common(cpu, pc, cs_base, flags, cflags,
+                              phys_pc, host_pc);
+}
+#endif
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -725,6 +790,7 @@ void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t lp_fill, lp_flush;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -765,11 +831,19 @@ void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB region evictions %u (%zu TBs)\n",
+                           qatomic_read(&tb_ctx.tb_evict_count),
+                           qatomic_read(&tb_ctx.tb_evict_tbs));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_large_page_counts(&lp_fill, &lp_flush);
+    g_string_append_printf(buf, "TLB large page fills %zu\n", lp_fill);
+    g_string_append_printf(buf, "TLB large page flush %zu\n", lp_flush);
+    dump_smc_info(buf);
+    dump_pretranslate_info(buf);
     tcg_dump_info(buf);
 }
 
@@ -125,7 +125,15 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    /* Remember the target as a candidate for pretranslation. */
+    if (tcg_ctx->nb_goto_tb_dest < ARRAY_SIZE(tcg_ctx->goto_tb_dest)) {
+        tcg_ctx->goto_tb_dest[tcg_ctx->nb_goto_tb_dest++] = dest;
+    }
+    return true;
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
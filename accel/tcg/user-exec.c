@@ -23,6 +23,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translate-all.h"
 #include "exec/helper-proto.h"
@@ -144,6 +145,16 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Lockless lookups in pageflags_root may miss nodes that are being moved
+ * around by a concurrent update (see util/interval-tree.c), but never
+ * return a node that does not overlap.  Updates, which are serialized by
+ * mmap_lock, bump pageflags_seq so that lockless readers can tell a real
+ * miss from a racy one without taking mmap_lock themselves.  Removed
+ * nodes are freed with RCU.
+ */
+static QemuSeqLock pageflags_seq;
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -207,24 +218,18 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
+    PageFlagsNode *p;
+    unsigned seq;
+    int flags;
 
-    /*
-     * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
-     */
-    if (p) {
-        return p->flags;
-    }
-    if (have_mmap_lock()) {
-        return 0;
-    }
+    RCU_READ_LOCK_GUARD();
+    do {
+        seq = seqlock_read_begin(&pageflags_seq);
+        p = pageflags_find(address, address);
+        flags = p ? qatomic_read(&p->flags) : 0;
+    } while (!p && seqlock_read_retry(&pageflags_seq, seq));
 
-    mmap_lock();
-    p = pageflags_find(address, address);
-    mmap_unlock();
-    return p ? p->flags : 0;
+    return flags;
 }
 
 /* A subroutine of page_set_flags: insert a new node for [start,last]. */
@@ -243,6 +248,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
 {
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         target_ulong p_last;
@@ -276,6 +282,7 @@ static bool pageflags_unset(target_ulong start, target_ulong last)
             break;
         }
     }
+    seqlock_write_end(&pageflags_seq);
 
     return inval_tb;
 }
@@ -344,6 +351,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     int p_flags, merge_flags;
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
  restart:
     p = pageflags_find(start, last);
     if (!p) {
@@ -375,7 +383,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
      */
     if (start == p_start && last == p_last) {
         if (merge_flags) {
-            p->flags = merge_flags;
+            qatomic_set(&p->flags, merge_flags);
         } else {
             interval_tree_remove(&p->itree, &pageflags_root);
             g_free_rcu(p, rcu);
@@ -420,7 +428,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
                 }
             } else {
                 if (merge_flags) {
-                    p->flags = merge_flags;
+                    qatomic_set(&p->flags, merge_flags);
                 } else {
                     interval_tree_remove(&p->itree, &pageflags_root);
                     g_free_rcu(p, rcu);
@@ -472,6 +480,7 @@ static bool pageflags_set_clear(target_ulong start, target_ulong last,
     }
 
  done:
+    seqlock_write_end(&pageflags_seq);
     return inval_tb;
 }
 
@@ -522,8 +531,9 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
 
 bool page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    target_ulong last;
+    target_ulong first, last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    unsigned seq;
     bool ret;
 
     if (len == 0) {
@@ -535,25 +545,18 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         return false; /* wrap around */
     }
 
+    RCU_READ_LOCK_GUARD();
+    first = start;
     locked = have_mmap_lock();
+    seq = seqlock_read_begin(&pageflags_seq);
+ retry:
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
-                /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
-                 */
-                mmap_lock();
-                locked = -1;
-                p = pageflags_find(start, last);
-            }
-            if (!p) {
-                ret = false; /* entire region invalid */
-                break;
-            }
+            ret = false; /* entire region invalid */
+            break;
         }
         if (start < p->itree.start) {
             ret = false; /* initial bytes invalid */
@@ -591,6 +594,17 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         start = p->itree.last + 1;
     }
 
+    if (!ret && !locked && seqlock_read_retry(&pageflags_seq, seq)) {
+        /*
+         * The tree changed under our feet, so this may have been a false
+         * negative of the lockless lookup.  Retry with the lock held.
+         */
+        mmap_lock();
+        locked = -1;
+        start = first;
+        goto retry;
+    }
+
     /* Release the lock if acquired locally. */
     if (locked < 0) {
         mmap_unlock();
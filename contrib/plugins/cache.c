@@ -20,7 +20,6 @@ static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static GHashTable *miss_ht;
 
 static GMutex hashtable_lock;
-static GRand *rng;
 
 static int limit;
 static bool sys;
@@ -56,9 +55,22 @@ enum EvictionPolicy policy;
  * The CacheSet also contains bookkeaping information about eviction details.
  */
 
+enum MESIState {
+    MESI_I,
+    MESI_S,
+    MESI_E,
+    MESI_M,
+};
+
 typedef struct {
     uint64_t tag;
     bool valid;
+    /* Private caches, when simulating coherence: enum MESIState */
+    uint8_t state;
+    /* Shared cache directory: core holding the block in E or M, or -1 */
+    int8_t owner;
+    /* Shared cache directory: cores that may hold the block */
+    uint64_t sharers;
 } CacheBlock;
 
 typedef struct {
@@ -78,17 +90,95 @@ typedef struct {
     uint64_t tag_mask;
     uint64_t accesses;
     uint64_t misses;
+    GRand *rng;
 } Cache;
 
 typedef struct {
     char *disas_str;
     const char *symbol;
     uint64_t addr;
+    uint64_t fetches;
+    uint64_t daccesses;
     uint64_t l1_dmisses;
     uint64_t l1_imisses;
     uint64_t l2_misses;
+    uint64_t llc_misses;
 } InsnData;
 
+enum AccessType {
+    ACCESS_FETCH,
+    ACCESS_LOAD,
+    ACCESS_STORE,
+};
+
+/*
+ * Per-instruction access counts would bounce between cores if they were
+ * updated in place. Each core accumulates them in a small direct-mapped
+ * table instead, and only folds them into the InsnData when a slot is
+ * reused or at exit.
+ */
+#define INSN_COUNT_SLOTS 4096
+
+typedef struct {
+    InsnData *insn;
+    uint64_t fetches;
+    uint64_t daccesses;
+} InsnCountSlot;
+
+/* Request from the shared cache to drop or downgrade a private copy */
+typedef struct {
+    uint64_t addr;
+    bool invalidate;
+} CoherenceMsg;
+
+/*
+ * The private caches of a core are only ever touched by the thread
+ * holding its lock: the vCPU itself, or the worker thread in charge of
+ * the core. Other cores reach them through coherence messages, which the
+ * owner applies before simulating its next accesses.
+ */
+typedef struct {
+    GMutex lock;
+    InsnCountSlot *insn_counts;
+
+    GMutex msg_lock;
+    GArray *msgs;
+    int n_msgs;
+    GArray *msgs_spare;
+
+    uint64_t llc_accesses;
+    uint64_t llc_misses;
+    uint64_t upgrades;
+    uint64_t transfers;
+    uint64_t invalidations;
+    uint64_t downgrades;
+    uint64_t writebacks;
+} CoreState;
+
+/*
+ * With worker threads, a vCPU only records its accesses to a private
+ * ring, which the worker in charge of its core consumes in batches.
+ * head and tail live in separate cache lines, as each has a single
+ * writer.
+ */
+#define EVQ_SIZE 4096
+#define MAX_QUEUES 4096
+#define WORKER_IDLE_US 50
+
+typedef struct {
+    uint64_t addr;
+    InsnData *insn;
+    enum AccessType type;
+} CacheEvent;
+
+typedef struct {
+    uint64_t head;
+    char pad0[56];
+    uint64_t tail;
+    char pad1[56];
+    CacheEvent ev[EVQ_SIZE];
+} EventQueue;
+
 void (*update_hit)(Cache *cache, int set, int blk);
 void (*update_miss)(Cache *cache, int set, int blk);
 
@@ -101,9 +191,17 @@ static Cache **l1_dcaches, **l1_icaches;
 static bool use_l2;
 static Cache **l2_ucaches;
 
-static GMutex *l1_dcache_locks;
-static GMutex *l1_icache_locks;
-static GMutex *l2_ucache_locks;
+static bool use_llc;
+static Cache *llc;
+static GMutex *llc_locks;
+
+static CoreState *core_states;
+
+static int n_workers;
+static GThread **workers;
+static EventQueue *queues[MAX_QUEUES];
+static int n_queues;
+static bool stopping;
 
 static uint64_t l1_dmem_accesses;
 static uint64_t l1_imem_accesses;
@@ -266,6 +364,7 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     cache->blksize_shift = pow_of_two(blksize);
     cache->accesses = 0;
     cache->misses = 0;
+    cache->rng = policy == RAND ? g_rand_new() : NULL;
 
     for (i = 0; i < cache->num_sets; i++) {
         cache->sets[i].blocks = g_new0(CacheBlock, assoc);
@@ -317,7 +416,7 @@ static int get_replaced_block(Cache *cache, int set)
 {
     switch (policy) {
     case RAND:
-        return g_rand_int_range(rng, 0, cache->assoc);
+        return g_rand_int_range(cache->rng, 0, cache->assoc);
     case LRU:
         return lru_get_lru_block(cache, set);
     case FIFO:
@@ -346,17 +445,21 @@ static int in_cache(Cache *cache, uint64_t addr)
 }
 
 /**
- * access_cache(): Simulate a cache access
+ * access_block(): Simulate a cache access
  * @cache: The cache under simulation
  * @addr: The address of the requested memory location
+ * @hit: Set to whether the requested data was in the cache
+ * @victim: On a miss, set to the block replaced to make room for @addr
  *
- * Returns true if the requested data is hit in the cache and false when missed.
- * The cache is updated on miss for the next access.
+ * Returns the block now holding @addr. On a miss it is freshly
+ * allocated, with an invalid coherence state.
  */
-static bool access_cache(Cache *cache, uint64_t addr)
+static CacheBlock *access_block(Cache *cache, uint64_t addr, bool *hit,
+                                CacheBlock *victim)
 {
     int hit_blk, replaced_blk;
     uint64_t tag, set;
+    CacheBlock *blk;
 
     tag = extract_tag(cache, addr);
     set = extract_set(cache, addr);
@@ -366,7 +469,8 @@ static bool access_cache(Cache *cache, uint64_t addr)
         if (update_hit) {
             update_hit(cache, set, hit_blk);
         }
-        return true;
+        *hit = true;
+        return &cache->sets[set].blocks[hit_blk];
     }
 
     replaced_blk = get_invalid_block(cache, set);
@@ -379,87 +483,532 @@ static bool access_cache(Cache *cache, uint64_t addr)
         update_miss(cache, set, replaced_blk);
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    blk = &cache->sets[set].blocks[replaced_blk];
+    *victim = *blk;
+    *blk = (CacheBlock) { .tag = tag, .valid = true, .owner = -1 };
+    *hit = false;
 
-    return false;
+    return blk;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+/**
+ * access_cache(): Simulate a cache access
+ * @cache: The cache under simulation
+ * @addr: The address of the requested memory location
+ *
+ * Returns true if the requested data is hit in the cache and false when missed.
+ * The cache is updated on miss for the next access.
+ */
+static bool access_cache(Cache *cache, uint64_t addr)
 {
-    uint64_t effective_addr;
-    struct qemu_plugin_hwaddr *hwaddr;
-    int cache_idx;
-    InsnData *insn;
-    bool hit_in_l1;
+    CacheBlock victim;
+    bool hit;
 
-    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+    access_block(cache, addr, &hit, &victim);
+    return hit;
+}
+
+/* Return the block holding @addr, without counting it as an access. */
+static CacheBlock *find_block(Cache *cache, uint64_t addr)
+{
+    int blk = in_cache(cache, addr);
+
+    return blk == -1 ? NULL : &cache->sets[extract_set(cache, addr)].blocks[blk];
+}
+
+static inline uint64_t block_addr(Cache *cache, const CacheBlock *blk,
+                                  uint64_t set)
+{
+    return blk->tag | (set << cache->blksize_shift);
+}
+
+static void insn_count_flush(InsnCountSlot *slot)
+{
+    if (slot->insn) {
+        __atomic_fetch_add(&slot->insn->fetches, slot->fetches,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(&slot->insn->daccesses, slot->daccesses,
+                           __ATOMIC_RELAXED);
+    }
+    slot->fetches = 0;
+    slot->daccesses = 0;
+}
+
+static void insn_count(int core, InsnData *insn, bool fetch)
+{
+    uintptr_t idx = (uintptr_t) insn / sizeof(InsnData) % INSN_COUNT_SLOTS;
+    InsnCountSlot *slot = &core_states[core].insn_counts[idx];
+
+    if (slot->insn != insn) {
+        insn_count_flush(slot);
+        slot->insn = insn;
+    }
+    if (fetch) {
+        slot->fetches++;
+    } else {
+        slot->daccesses++;
+    }
+}
+
+/*
+ * Coherence model
+ *
+ * When a shared last level cache (LLC) is simulated, the private caches
+ * of each core keep an MESI state for each block, and the LLC keeps a
+ * directory of the cores holding each of its blocks. The LLC is
+ * inclusive, and so is the private L2 with respect to the L1 caches of
+ * its core; all levels must use the same block size.
+ *
+ * A private miss, or a store to a Shared block, is a request to the LLC,
+ * which invalidates or downgrades the copies held by other cores as
+ * needed. Each set of the LLC has its own lock, so that cores only ever
+ * contend on accesses to the same set. Invalidations and downgrades are
+ * posted to the target core and applied before it simulates its next
+ * accesses; the interleaving of accesses from different cores is thus
+ * approximate, like it already is with several vCPUs running in parallel.
+ */
+
+/* Invalidate or downgrade the copies of @addr held by @core. */
+static bool private_apply(int core, uint64_t addr, bool invalidate)
+{
+    Cache *private[] = {
+        l1_dcaches[core], l1_icaches[core], use_l2 ? l2_ucaches[core] : NULL
+    };
+    bool found = false;
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(private) && private[i]; i++) {
+        CacheBlock *blk = find_block(private[i], addr);
+
+        if (!blk) {
+            continue;
+        }
+        found = true;
+        if (invalidate) {
+            blk->valid = false;
+            blk->state = MESI_I;
+        } else if (blk->state > MESI_S) {
+            blk->state = MESI_S;
+        }
+    }
+    return found;
+}
+
+/* Apply a coherence message to the private caches of @core. */
+static void core_apply(int core, uint64_t addr, bool invalidate)
+{
+    CoreState *cs = &core_states[core];
+
+    if (!private_apply(core, addr, invalidate)) {
         return;
     }
+    if (invalidate) {
+        cs->invalidations++;
+    } else {
+        cs->downgrades++;
+    }
+}
 
-    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
-    cache_idx = vcpu_index % cores;
+static void core_post(int core, uint64_t addr, bool invalidate)
+{
+    CoreState *cs = &core_states[core];
+    CoherenceMsg msg = { .addr = addr, .invalidate = invalidate };
 
-    g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
-    if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
+    g_mutex_lock(&cs->msg_lock);
+    g_array_append_val(cs->msgs, msg);
+    __atomic_store_n(&cs->n_msgs, cs->msgs->len, __ATOMIC_RELEASE);
+    g_mutex_unlock(&cs->msg_lock);
+}
+
+/* Called by the owner of @core before simulating accesses. */
+static void core_handle_msgs(int core)
+{
+    CoreState *cs = &core_states[core];
+    GArray *msgs;
+    int i;
+
+    if (!use_llc || !__atomic_load_n(&cs->n_msgs, __ATOMIC_ACQUIRE)) {
+        return;
     }
-    l1_dcaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
 
-    if (hit_in_l1 || !use_l2) {
-        /* No need to access L2 */
+    g_mutex_lock(&cs->msg_lock);
+    msgs = cs->msgs;
+    cs->msgs = cs->msgs_spare;
+    __atomic_store_n(&cs->n_msgs, 0, __ATOMIC_RELAXED);
+    g_mutex_unlock(&cs->msg_lock);
+
+    for (i = 0; i < msgs->len; i++) {
+        CoherenceMsg *msg = &g_array_index(msgs, CoherenceMsg, i);
+
+        core_apply(core, msg->addr, msg->invalidate);
+    }
+    g_array_set_size(msgs, 0);
+    cs->msgs_spare = msgs;
+}
+
+static void post_to_sharers(int core, uint64_t sharers, uint64_t addr,
+                            bool invalidate)
+{
+    while (sharers) {
+        int target = __builtin_ctzll(sharers);
+
+        sharers &= sharers - 1;
+        if (target == core) {
+            /* we own our private caches already */
+            core_apply(core, addr, invalidate);
+        } else {
+            core_post(target, addr, invalidate);
+        }
+    }
+}
+
+/**
+ * llc_request(): Request a block from the shared cache
+ * @core: The requesting core
+ * @addr: The address of the requested memory location
+ * @write: Whether the block is requested for writing
+ * @insn: The instruction performing the access
+ *
+ * Returns the state the private caches of @core get the block in.
+ */
+static enum MESIState llc_request(int core, uint64_t addr, bool write,
+                                  InsnData *insn)
+{
+    CoreState *cs = &core_states[core];
+    uint64_t set = extract_set(llc, addr);
+    uint64_t self = 1ULL << core;
+    CacheBlock *blk, victim;
+    enum MESIState state;
+    bool hit;
+
+    g_mutex_lock(&llc_locks[set]);
+    blk = access_block(llc, addr, &hit, &victim);
+    if (!hit && victim.valid) {
+        /* back-invalidate, the shared cache is inclusive */
+        post_to_sharers(core, victim.sharers, block_addr(llc, &victim, set),
+                        true);
+    }
+
+    if (blk->owner != -1 && blk->owner != core) {
+        cs->transfers++;
+    }
+    if (write) {
+        post_to_sharers(core, blk->sharers & ~self, addr, true);
+        blk->sharers = self;
+        blk->owner = core;
+        state = MESI_M;
+    } else {
+        if (blk->owner != -1 && blk->owner != core) {
+            post_to_sharers(core, 1ULL << blk->owner, addr, false);
+        }
+        blk->sharers |= self;
+        if (blk->sharers == self) {
+            blk->owner = core;
+            state = MESI_E;
+        } else {
+            blk->owner = -1;
+            state = MESI_S;
+        }
+    }
+    g_mutex_unlock(&llc_locks[set]);
+
+    cs->llc_accesses++;
+    if (!hit) {
+        cs->llc_misses++;
+        __atomic_fetch_add(&insn->llc_misses, 1, __ATOMIC_RELAXED);
+    }
+    return state;
+}
+
+/* Tell the directory that @core no longer holds @victim. */
+static void llc_release(int core, uint64_t addr, const CacheBlock *victim)
+{
+    uint64_t set = extract_set(llc, addr);
+    CacheBlock *blk;
+
+    g_mutex_lock(&llc_locks[set]);
+    blk = find_block(llc, addr);
+    if (blk) {
+        blk->sharers &= ~(1ULL << core);
+        if (blk->owner == core) {
+            blk->owner = -1;
+        }
+    }
+    g_mutex_unlock(&llc_locks[set]);
+
+    if (victim->state == MESI_M) {
+        core_states[core].writebacks++;
+    }
+}
+
+/* @victim was replaced in @cache, one of the private caches of @core. */
+static void private_evicted(int core, Cache *cache, const CacheBlock *victim,
+                            uint64_t addr)
+{
+    uint64_t victim_addr;
+    Cache *other;
+
+    if (!victim->valid) {
         return;
     }
+    victim_addr = block_addr(cache, victim, extract_set(cache, addr));
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+    if (use_l2) {
+        if (cache != l2_ucaches[core]) {
+            /* still held by the inclusive L2 */
+            return;
+        }
+        private_apply(core, victim_addr, true);
+    } else {
+        other = cache == l1_dcaches[core] ? l1_icaches[core] : l1_dcaches[core];
+        if (find_block(other, victim_addr)) {
+            return;
+        }
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    llc_release(core, victim_addr, victim);
 }
 
-static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+static void private_set_state(int core, uint64_t addr, enum MESIState state)
 {
-    uint64_t insn_addr;
-    InsnData *insn;
-    int cache_idx;
+    Cache *private[] = {
+        l1_dcaches[core], l1_icaches[core], use_l2 ? l2_ucaches[core] : NULL
+    };
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(private) && private[i]; i++) {
+        CacheBlock *blk = find_block(private[i], addr);
+
+        if (blk) {
+            blk->state = state;
+        }
+    }
+}
+
+static void coherent_access(int core, uint64_t addr, InsnData *insn,
+                            bool fetch, bool write)
+{
+    Cache *l1 = fetch ? l1_icaches[core] : l1_dcaches[core];
+    enum MESIState state = MESI_I;
+    CacheBlock *blk, victim;
+    bool hit;
+
+    blk = access_block(l1, addr, &hit, &victim);
+    l1->accesses++;
+    if (hit) {
+        state = blk->state;
+    } else {
+        l1->misses++;
+        __atomic_fetch_add(fetch ? &insn->l1_imisses : &insn->l1_dmisses, 1,
+                           __ATOMIC_RELAXED);
+        private_evicted(core, l1, &victim, addr);
+
+        if (use_l2) {
+            Cache *l2 = l2_ucaches[core];
+
+            blk = access_block(l2, addr, &hit, &victim);
+            l2->accesses++;
+            if (hit) {
+                state = blk->state;
+            } else {
+                l2->misses++;
+                __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
+                private_evicted(core, l2, &victim, addr);
+            }
+        }
+    }
+
+    if (state == MESI_I) {
+        state = llc_request(core, addr, write, insn);
+    } else if (write && state == MESI_S) {
+        llc_request(core, addr, true, insn);
+        core_states[core].upgrades++;
+        state = MESI_M;
+    } else if (write) {
+        state = MESI_M;
+    }
+    private_set_state(core, addr, state);
+}
+
+/* Simulate an access of @core; the caller owns its private caches. */
+static void simulate_access(int core, uint64_t addr, InsnData *insn,
+                            enum AccessType type)
+{
+    bool fetch = type == ACCESS_FETCH;
+    Cache *l1 = fetch ? l1_icaches[core] : l1_dcaches[core];
     bool hit_in_l1;
 
-    insn_addr = ((InsnData *) userdata)->addr;
+    insn_count(core, insn, fetch);
+
+    if (use_llc) {
+        coherent_access(core, addr, insn, fetch, type == ACCESS_STORE);
+        return;
+    }
 
-    cache_idx = vcpu_index % cores;
-    g_mutex_lock(&l1_icache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
+    hit_in_l1 = access_cache(l1, addr);
     if (!hit_in_l1) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
-        l1_icaches[cache_idx]->misses++;
+        __atomic_fetch_add(fetch ? &insn->l1_imisses : &insn->l1_dmisses, 1,
+                           __ATOMIC_RELAXED);
+        l1->misses++;
     }
-    l1_icaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+    l1->accesses++;
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
-        insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+    if (!access_cache(l2_ucaches[core], addr)) {
+        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
+        l2_ucaches[core]->misses++;
+    }
+    l2_ucaches[core]->accesses++;
+}
+
+static size_t evq_drain(EventQueue *q, int core)
+{
+    uint64_t tail = q->tail;
+    uint64_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint64_t i;
+
+    for (i = tail; i != head; i++) {
+        CacheEvent *ev = &q->ev[i % EVQ_SIZE];
+
+        simulate_access(core, ev->addr, ev->insn, ev->type);
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    __atomic_store_n(&q->tail, head, __ATOMIC_RELEASE);
+
+    return head - tail;
+}
+
+static void evq_push(EventQueue *q, uint64_t addr, InsnData *insn,
+                     enum AccessType type)
+{
+    uint64_t head = q->head;
+    CacheEvent *ev;
+
+    /* wait for the worker to catch up rather than drop accesses */
+    while (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == EVQ_SIZE) {
+        if (__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+            return;
+        }
+        g_thread_yield();
+    }
+
+    ev = &q->ev[head % EVQ_SIZE];
+    ev->addr = addr;
+    ev->insn = insn;
+    ev->type = type;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Return the queue of @vcpu_index, which only that vCPU may call. */
+static EventQueue *vcpu_queue(unsigned int vcpu_index)
+{
+    EventQueue *q;
+    int n;
+
+    if (vcpu_index >= MAX_QUEUES) {
+        return NULL;
+    }
+
+    q = queues[vcpu_index];
+    if (q) {
+        return q;
+    }
+
+    q = g_new0(EventQueue, 1);
+    __atomic_store_n(&queues[vcpu_index], q, __ATOMIC_RELEASE);
+    n = __atomic_load_n(&n_queues, __ATOMIC_RELAXED);
+    while (n <= vcpu_index &&
+           !__atomic_compare_exchange_n(&n_queues, &n, vcpu_index + 1, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        /* n was updated, retry */
+    }
+    return q;
+}
+
+static void cache_access(unsigned int vcpu_index, uint64_t addr,
+                         InsnData *insn, enum AccessType type)
+{
+    int core = vcpu_index % cores;
+    CoreState *cs = &core_states[core];
+    EventQueue *q = n_workers ? vcpu_queue(vcpu_index) : NULL;
+
+    if (q) {
+        evq_push(q, addr, insn, type);
+        return;
+    }
+
+    g_mutex_lock(&cs->lock);
+    core_handle_msgs(core);
+    simulate_access(core, addr, insn, type);
+    g_mutex_unlock(&cs->lock);
+}
+
+/*
+ * Each worker thread simulates a fixed subset of the cores, in batches
+ * of accesses taken from the queues of the vCPUs mapped to them.
+ */
+static gpointer cache_worker(gpointer opaque)
+{
+    int w = GPOINTER_TO_INT(opaque);
+
+    while (true) {
+        bool stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        int n = __atomic_load_n(&n_queues, __ATOMIC_ACQUIRE);
+        size_t done = 0;
+        int v;
+
+        for (v = 0; v < n; v++) {
+            int core = v % cores;
+            EventQueue *q;
+
+            if (core % n_workers != w) {
+                continue;
+            }
+            q = __atomic_load_n(&queues[v], __ATOMIC_ACQUIRE);
+            if (!q) {
+                continue;
+            }
+
+            g_mutex_lock(&core_states[core].lock);
+            core_handle_msgs(core);
+            done += evq_drain(q, core);
+            g_mutex_unlock(&core_states[core].lock);
+        }
+
+        if (done == 0) {
+            if (stop) {
+                break;
+            }
+            g_usleep(WORKER_IDLE_US);
+        }
+    }
+
+    return NULL;
+}
+
+static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *userdata)
+{
+    uint64_t effective_addr;
+    struct qemu_plugin_hwaddr *hwaddr;
+
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+        return;
+    }
+
+    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+    cache_access(vcpu_index, effective_addr, userdata,
+                 qemu_plugin_mem_is_store(info) ? ACCESS_STORE : ACCESS_LOAD);
+}
+
+static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
+{
+    InsnData *insn = userdata;
+
+    cache_access(vcpu_index, insn->addr, insn, ACCESS_FETCH);
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
@@ -522,6 +1071,10 @@ static void cache_free(Cache *cache)
         metadata_destroy(cache);
     }
 
+    if (cache->rng) {
+        g_rand_free(cache->rng);
+    }
+
     g_free(cache->sets);
     g_free(cache);
 }
@@ -643,7 +1196,118 @@ static void log_stats(void)
     }
 
     g_string_append(rep, "\n");
+
+    if (use_llc) {
+        g_string_append(rep, "core #, llc accesses, llc misses, llc miss rate,"
+                        " upgrades, transfers, invalidations, downgrades,"
+                        " writebacks\n");
+        for (i = 0; i < cores; i++) {
+            CoreState *cs = &core_states[i];
+
+            g_string_append_printf(rep, "%-8d%-14" PRIu64 " %-12" PRIu64
+                                   " %9.4lf%%  %-9" PRIu64 " %-10" PRIu64
+                                   " %-14" PRIu64 " %-12" PRIu64
+                                   " %-10" PRIu64 "\n",
+                                   i, cs->llc_accesses, cs->llc_misses,
+                                   cs->llc_accesses ?
+                                   (double) cs->llc_misses /
+                                   cs->llc_accesses * 100.0 : 0.0,
+                                   cs->upgrades, cs->transfers,
+                                   cs->invalidations, cs->downgrades,
+                                   cs->writebacks);
+        }
+        g_string_append(rep, "\n");
+    }
+
+    qemu_plugin_outs(rep->str);
+}
+
+typedef struct {
+    const char *name;
+    uint64_t fetches;
+    uint64_t daccesses;
+    uint64_t l1_imisses;
+    uint64_t l1_dmisses;
+    uint64_t l2_misses;
+    uint64_t llc_misses;
+} FuncData;
+
+static int func_cmp(gconstpointer a, gconstpointer b)
+{
+    const FuncData *func_a = a;
+    const FuncData *func_b = b;
+
+    return func_a->l1_imisses + func_a->l1_dmisses <
+           func_b->l1_imisses + func_b->l1_dmisses ? 1 : -1;
+}
+
+static void log_top_functions(void)
+{
+    g_autoptr(GHashTable) funcs = g_hash_table_new_full(g_str_hash,
+                                                        g_str_equal,
+                                                        NULL, g_free);
+    g_autoptr(GString) rep = g_string_new("function, fetches, imiss rate,"
+                                          " data accesses, dmiss rate");
+    GList *curr, *list;
+    GHashTableIter iter;
+    InsnData *insn;
+    FuncData *func;
+    int i;
+
+    g_hash_table_iter_init(&iter, miss_ht);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &insn)) {
+        const char *name = insn->symbol ? insn->symbol : "[unknown]";
+
+        func = g_hash_table_lookup(funcs, name);
+        if (!func) {
+            func = g_new0(FuncData, 1);
+            func->name = name;
+            g_hash_table_insert(funcs, (gpointer) name, func);
+        }
+        func->fetches += insn->fetches;
+        func->daccesses += insn->daccesses;
+        func->l1_imisses += insn->l1_imisses;
+        func->l1_dmisses += insn->l1_dmisses;
+        func->l2_misses += insn->l2_misses;
+        func->llc_misses += insn->llc_misses;
+    }
+
+    if (use_l2) {
+        g_string_append(rep, ", l2 misses, l2 miss rate");
+    }
+    if (use_llc) {
+        g_string_append(rep, ", llc misses");
+    }
+    g_string_append(rep, "\n");
+
+    list = g_list_sort(g_hash_table_get_values(funcs), func_cmp);
+    for (curr = list, i = 0; curr && i < limit; i++, curr = curr->next) {
+        uint64_t l1_misses;
+
+        func = curr->data;
+        l1_misses = func->l1_imisses + func->l1_dmisses;
+        g_string_append_printf(rep, "%s, %" PRIu64 ", %.4lf%%, %" PRIu64
+                               ", %.4lf%%", func->name, func->fetches,
+                               func->fetches ? (double) func->l1_imisses /
+                               func->fetches * 100.0 : 0.0,
+                               func->daccesses,
+                               func->daccesses ? (double) func->l1_dmisses /
+                               func->daccesses * 100.0 : 0.0);
+        if (use_l2) {
+            g_string_append_printf(rep, ", %" PRIu64 ", %.4lf%%",
+                                   func->l2_misses,
+                                   l1_misses ? (double) func->l2_misses /
+                                   l1_misses * 100.0 : 0.0);
+        }
+        if (use_llc) {
+            g_string_append_printf(rep, ", %" PRIu64, func->llc_misses);
+        }
+        g_string_append(rep, "\n");
+    }
+    g_string_append(rep, "\n");
+
     qemu_plugin_outs(rep->str);
+    g_list_free(list);
 }
 
 static void log_top_insns(void)
@@ -704,20 +1368,48 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    int i, j;
+
+    /* let the workers drain the queues */
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    for (i = 0; i < n_workers; i++) {
+        g_thread_join(workers[i]);
+    }
+    g_free(workers);
+
+    for (i = 0; i < cores; i++) {
+        CoreState *cs = &core_states[i];
+
+        g_mutex_lock(&cs->lock);
+        for (j = 0; j < INSN_COUNT_SLOTS; j++) {
+            insn_count_flush(&cs->insn_counts[j]);
+        }
+        g_mutex_unlock(&cs->lock);
+    }
+
     log_stats();
+    log_top_functions();
     log_top_insns();
 
     caches_free(l1_dcaches);
     caches_free(l1_icaches);
 
-    g_free(l1_dcache_locks);
-    g_free(l1_icache_locks);
-
     if (use_l2) {
         caches_free(l2_ucaches);
-        g_free(l2_ucache_locks);
     }
 
+    if (use_llc) {
+        cache_free(llc);
+        g_free(llc_locks);
+    }
+
+    for (i = 0; i < cores; i++) {
+        g_free(core_states[i].insn_counts);
+        g_array_free(core_states[i].msgs, true);
+        g_array_free(core_states[i].msgs_spare, true);
+    }
+    g_free(core_states);
+
     g_hash_table_destroy(miss_ht);
 }
 
@@ -736,7 +1428,6 @@ static void policy_init(void)
         metadata_destroy = fifo_destroy;
         break;
     case RAND:
-        rng = g_rand_new();
         break;
     default:
         g_assert_not_reached();
@@ -751,6 +1442,7 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     int l1_iassoc, l1_iblksize, l1_icachesize;
     int l1_dassoc, l1_dblksize, l1_dcachesize;
     int l2_assoc, l2_blksize, l2_cachesize;
+    int llc_assoc, llc_blksize, llc_cachesize;
 
     limit = 32;
     sys = info->system_emulation;
@@ -767,6 +1459,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l2_blksize = 64;
     l2_cachesize = l2_assoc * l2_blksize * 2048;
 
+    llc_assoc = 16;
+    llc_blksize = 64;
+    llc_cachesize = llc_assoc * llc_blksize * 8192;
+
     policy = LRU;
 
     cores = sys ? qemu_plugin_n_vcpus() : 1;
@@ -805,6 +1501,22 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "llccachesize") == 0) {
+            use_llc = true;
+            llc_cachesize = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "llcblksize") == 0) {
+            use_llc = true;
+            llc_blksize = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "llcassoc") == 0) {
+            use_llc = true;
+            llc_assoc = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "llc") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &use_llc)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "workers") == 0) {
+            n_workers = STRTOLL(tokens[1]);
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -816,12 +1528,39 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "invalid eviction policy: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "sample") == 0) {
+            uint64_t n = STRTOLL(tokens[1]);
+
+            /* instrument one window of 1000 TBs out of every n */
+            if (n < 2 || qemu_plugin_register_sampling(
+                    id, QEMU_PLUGIN_SAMPLE_TBS, n * 1000, 1000)) {
+                fprintf(stderr, "invalid sampling rate: %s\n", opt);
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
         }
     }
 
+    if (cores < 1 || n_workers < 0) {
+        fprintf(stderr, "invalid number of cores or workers\n");
+        return -1;
+    }
+    n_workers = MIN(n_workers, cores);
+
+    if (use_llc) {
+        if (cores > 64) {
+            fprintf(stderr, "llc supports at most 64 cores\n");
+            return -1;
+        }
+        if (l1_dblksize != llc_blksize || l1_iblksize != llc_blksize ||
+            (use_l2 && l2_blksize != llc_blksize)) {
+            fprintf(stderr, "llc requires the same block size at all levels\n");
+            return -1;
+        }
+    }
+
     policy_init();
 
     l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize);
@@ -848,9 +1587,31 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
-    l1_dcache_locks = g_new0(GMutex, cores);
-    l1_icache_locks = g_new0(GMutex, cores);
-    l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
+    if (use_llc) {
+        if (bad_cache_params(llc_blksize, llc_assoc, llc_cachesize)) {
+            const char *err = cache_config_error(llc_blksize, llc_assoc,
+                                                 llc_cachesize);
+            fprintf(stderr, "LLC cannot be constructed from given parameters\n");
+            fprintf(stderr, "%s\n", err);
+            return -1;
+        }
+        llc = cache_init(llc_blksize, llc_assoc, llc_cachesize);
+        llc_locks = g_new0(GMutex, llc->num_sets);
+    }
+
+    core_states = g_new0(CoreState, cores);
+    for (i = 0; i < cores; i++) {
+        core_states[i].insn_counts = g_new0(InsnCountSlot, INSN_COUNT_SLOTS);
+        core_states[i].msgs = g_array_new(false, false, sizeof(CoherenceMsg));
+        core_states[i].msgs_spare = g_array_new(false, false,
+                                                sizeof(CoherenceMsg));
+    }
+
+    workers = g_new0(GThread *, n_workers);
+    for (i = 0; i < n_workers; i++) {
+        workers[i] = g_thread_new("cache-sim", cache_worker,
+                                  GINT_TO_POINTER(i));
+    }
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
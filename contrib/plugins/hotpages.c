@@ -189,6 +189,15 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
             }
         } else if (g_strcmp0(tokens[0], "pagesize") == 0) {
             page_size = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "sample") == 0) {
+            uint64_t n = g_ascii_strtoull(tokens[1], NULL, 10);
+
+            /* instrument one window of 1000 TBs out of every n */
+            if (n < 2 || qemu_plugin_register_sampling(
+                    id, QEMU_PLUGIN_SAMPLE_TBS, n * 1000, 1000)) {
+                fprintf(stderr, "invalid sampling rate: %s\n", opt);
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
@@ -50,24 +50,63 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(&req->elem);
 }
 
-static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
+static void virtio_blk_req_set_status(VirtIOBlockReq *req,
+                                      unsigned char status)
 {
-    VirtIOBlock *s = req->dev;
-    VirtIODevice *vdev = VIRTIO_DEVICE(s);
-
-    trace_virtio_blk_req_complete(vdev, req, status);
+    trace_virtio_blk_req_complete(VIRTIO_DEVICE(req->dev), req, status);
 
     stb_p(&req->in->status, status);
     iov_discard_undo(&req->inhdr_undo);
     iov_discard_undo(&req->outhdr_undo);
-    virtqueue_push(req->vq, &req->elem, req->in_len);
+}
+
+static void virtio_blk_notify(VirtIOBlock *s, VirtQueue *vq)
+{
     if (s->dataplane_started && !s->dataplane_disabled) {
-        virtio_blk_data_plane_notify(s->dataplane, req->vq);
+        virtio_blk_data_plane_notify(s->dataplane, vq);
     } else {
-        virtio_notify(vdev, req->vq);
+        virtio_notify(VIRTIO_DEVICE(s), vq);
+    }
+}
+
+static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
+{
+    virtio_blk_req_set_status(req, status);
+    virtqueue_push(req->vq, &req->elem, req->in_len);
+    virtio_blk_notify(req->dev, req->vq);
+}
+
+/*
+ * Complete successful requests together, so that each queue gets a single
+ * used index update and notification.  Frees the requests.
+ */
+static void virtio_blk_req_complete_batch(VirtIOBlockReq **reqs,
+                                          unsigned int num)
+{
+    VirtQueueElement *elems[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int lens[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int i, n = 0;
+
+    for (i = 0; i < num; i++) {
+        VirtIOBlockReq *req = reqs[i];
+
+        virtio_blk_req_set_status(req, VIRTIO_BLK_S_OK);
+        elems[n] = &req->elem;
+        lens[n] = req->in_len;
+        n++;
+
+        if (i + 1 == num || reqs[i + 1]->vq != req->vq) {
+            virtqueue_push_batch(req->vq, elems, lens, n);
+            virtio_blk_notify(req->dev, req->vq);
+            n = 0;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        virtio_blk_free_request(reqs[i]);
     }
 }
 
@@ -100,6 +139,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtIOBlockReq *done[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_done = 0;
 
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     while (next) {
@@ -130,10 +171,14 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_blk_req_complete_batch(done, num_done);
+            num_done = 0;
+        }
+        done[num_done++] = req;
     }
+    virtio_blk_req_complete_batch(done, num_done);
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
 }
 
@@ -234,15 +279,8 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
-}
+/* Number of requests popped from the virtqueue at once. */
+#define VIRTIO_BLK_POP_BATCH 32
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
 {
@@ -1141,10 +1179,29 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+        for (;;) {
+            VirtQueueElement *elems[VIRTIO_BLK_POP_BATCH];
+            unsigned int i, n;
+
+            n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), elems,
+                                    ARRAY_SIZE(elems));
+            for (i = 0; i < n; i++) {
+                req = container_of(elems[i], VirtIOBlockReq, elem);
+                virtio_blk_init_request(s, vq, req);
+                if (virtio_blk_handle_request(req, &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* the device is broken, drop the rest of the batch */
+                for (; i < n; i++) {
+                    req = container_of(elems[i], VirtIOBlockReq, elem);
+                    virtqueue_detach_element(vq, &req->elem, 0);
+                    virtio_blk_free_request(req);
+                }
+                break;
+            }
+            if (n < ARRAY_SIZE(elems)) {
                 break;
             }
         }
@@ -1734,6 +1791,8 @@ static Property virtio_blk_properties[] = {
                        conf.max_write_zeroes_sectors, BDRV_REQUEST_MAX_SECTORS),
     DEFINE_PROP_BOOL("x-enable-wce-if-config-wce", VirtIOBlock,
                      conf.x_enable_wce_if_config_wce, true),
+    DEFINE_PROP_BIT64("in_order", VirtIOBlock, host_features,
+                      VIRTIO_F_IN_ORDER, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -124,6 +124,45 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+/*
+ * Interrupt the guest for @vq of @q.  Queues processed by an IOThread
+ * signal through the guest notifier, which does not need the BQL.
+ */
+static void virtio_net_notify(VirtIONetQueue *q, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+
+    if (q->ctx != qemu_get_aio_context()) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
+/*
+ * Exclude the IOThreads while the main loop changes state shared by the
+ * queue pairs.  The IOThreads only ever take their own AioContext lock.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_net_acquire_iothreads(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
+static void virtio_net_release_iothreads(VirtIONet *n)
+{
+    int i;
+
+    for (i = n->net_conf.num_iothreads - 1; i >= 0; i--) {
+        aio_context_release(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
 static void flush_or_purge_queued_packets(NetClientState *nc)
 {
     if (!nc->peer) {
@@ -373,11 +412,11 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
-static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_net_drop_tx_queue_data(VirtIONetQueue *q)
 {
-    unsigned int dropped = virtqueue_drop_all(vq);
+    unsigned int dropped = virtqueue_drop_all(q->tx_vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(q, q->tx_vq);
     }
 }
 
@@ -391,6 +430,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    virtio_net_acquire_iothreads(n);
     for (i = 0; i < n->max_queue_pairs; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -432,10 +472,11 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
                  * and disabled notification */
                 q->tx_waiting = 0;
                 virtio_queue_set_notification(q->tx_vq, 1);
-                virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
+                virtio_net_drop_tx_queue_data(q);
             }
         }
     }
+    virtio_net_release_iothreads(n);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -553,6 +594,7 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
+    AioContext *ctx;
 
     /* validate queue_index and skip for cvq */
     if (queue_index >= n->max_queue_pairs * 2) {
@@ -570,7 +612,10 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
         vhost_net_virtqueue_reset(vdev, nc, queue_index);
     }
 
+    ctx = n->vqs[vq2q(queue_index)].ctx;
+    aio_context_acquire(ctx);
     flush_or_purge_queued_packets(nc);
+    aio_context_release(ctx);
 }
 
 static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
@@ -823,6 +868,14 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_USO6);
     }
 
+    /* Software RSS and hash reporting are not done by IOThreads */
+    if (n->net_conf.num_iothreads) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+        if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        }
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
@@ -1582,8 +1635,10 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
+    virtio_net_acquire_iothreads(n);
     for (;;) {
         size_t written;
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -1603,6 +1658,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             break;
         }
     }
+    virtio_net_release_iothreads(n);
 }
 
 /* RX */
@@ -1611,8 +1667,11 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    AioContext *ctx = n->vqs[queue_index].ctx;
 
+    aio_context_acquire(ctx);
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    aio_context_release(ctx);
 }
 
 static bool virtio_net_can_receive(NetClientState *nc)
@@ -1905,7 +1964,12 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         return -1;
     }
 
-    if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss) {
+    /*
+     * Software RSS shares n->rx_pkt between the queues, so it is not used
+     * when the queues are processed by IOThreads.
+     */
+    if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss &&
+        !n->net_conf.num_iothreads) {
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
@@ -2017,7 +2081,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(q, q->rx_vq);
 
     return size;
 
@@ -2635,11 +2699,17 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
+    AioContext *ctx = virtio_net_get_subqueue(nc)->ctx;
+    ssize_t ret;
+
+    aio_context_acquire(ctx);
     if ((n->rsc4_enabled || n->rsc6_enabled)) {
-        return virtio_net_rsc_receive(nc, buf, size);
+        ret = virtio_net_rsc_receive(nc, buf, size);
     } else {
-        return virtio_net_do_receive(nc, buf, size);
+        ret = virtio_net_do_receive(nc, buf, size);
     }
+    aio_context_release(ctx);
+    return ret;
 }
 
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
@@ -2648,13 +2718,13 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
 
+    aio_context_acquire(q->ctx);
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(q, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2674,16 +2744,88 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
         }
         q->tx_waiting = 1;
     }
+    aio_context_release(q->ctx);
 }
 
 /* TX */
+/*
+ * Send the packet in @elem.  Returns 0 if the element can be returned to
+ * the guest, -EBUSY if the packet was queued by the backend, and -EINVAL
+ * if it was malformed, in which case the element is freed.
+ */
+static int virtio_net_tx_one(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        virtqueue_detach_element(q->tx_vq, elem, 0);
+        virtqueue_element_free(elem);
+        return -EINVAL;
+    }
+
+    if (n->has_vnet_hdr) {
+        if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            virtqueue_detach_element(q->tx_vq, elem, 0);
+            virtqueue_element_free(elem);
+            return -EINVAL;
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, (void *) &mhdr);
+            sg2[0].iov_base = &mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                /* drop */
+                return 0;
+            }
+            out_num += 1;
+            out_sg = sg2;
+        }
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+    }
+
+    if (qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                out_sg, out_num, virtio_net_tx_complete) == 0) {
+        return -EBUSY;
+    }
+    return 0;
+}
+
+/* Number of packets popped from the TX virtqueue at once. */
+#define VIRTIO_NET_TX_BATCH 32
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2693,107 +2835,79 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+    while (num_packets < n->tx_burst) {
+        VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+        unsigned int i, j, num;
+        int ret = 0;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        num = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement), elems,
+                                  MIN(ARRAY_SIZE(elems),
+                                      n->tx_burst - num_packets));
+        if (!num) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
+        for (i = 0; i < num; i++) {
+            ret = virtio_net_tx_one(q, elems[i]);
+            if (ret < 0) {
+                break;
+            }
         }
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-                }
-                out_num += 1;
-                out_sg = sg2;
+        /* Return the packets sent so far with one used index update */
+        if (i) {
+            virtqueue_push_batch(q->tx_vq, elems, NULL, i);
+            virtio_net_notify(q, q->tx_vq);
+            for (j = 0; j < i; j++) {
+                virtqueue_element_free(elems[j]);
             }
+            num_packets += i;
         }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
+
+        if (ret == -EBUSY) {
+            /* Resume from the next packet once the backend drains */
+            virtqueue_unpop_batch(q->tx_vq, elems + i + 1, num - i - 1);
+            for (j = i + 1; j < num; j++) {
+                virtqueue_element_free(elems[j]);
+            }
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            q->async_tx.elem = elems[i];
             return -EBUSY;
-        }
-
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
+        } else if (ret < 0) {
+            /* The device is broken, drop the rest of the batch */
+            for (j = i + 1; j < num; j++) {
+                virtqueue_detach_element(q->tx_vq, elems[j], 0);
+                virtqueue_element_free(elems[j]);
+            }
+            return ret;
         }
     }
     return num_packets;
 }
 
-static void virtio_net_tx_timer(void *opaque);
+static void virtio_net_tx_timer_locked(VirtIONetQueue *q);
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
+    aio_context_acquire(q->ctx);
     if (unlikely((n->status & VIRTIO_NET_S_LINK_UP) == 0)) {
-        virtio_net_drop_tx_queue_data(vdev, vq);
-        return;
+        virtio_net_drop_tx_queue_data(q);
+        goto out;
     }
 
     /* This happens when device was stopped but VCPU wasn't. */
     if (!vdev->vm_running) {
         q->tx_waiting = 1;
-        return;
+        goto out;
     }
 
     if (q->tx_waiting) {
         /* We already have queued packets, immediately flush */
         timer_del(q->tx_timer);
-        virtio_net_tx_timer(q);
+        virtio_net_tx_timer_locked(q);
     } else {
         /* re-arm timer to flush it (and more) on next tick */
         timer_mod(q->tx_timer,
@@ -2801,6 +2915,8 @@ static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
         q->tx_waiting = 1;
         virtio_queue_set_notification(vq, 0);
     }
+out:
+    aio_context_release(q->ctx);
 }
 
 static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
@@ -2808,26 +2924,28 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
+    aio_context_acquire(q->ctx);
     if (unlikely((n->status & VIRTIO_NET_S_LINK_UP) == 0)) {
-        virtio_net_drop_tx_queue_data(vdev, vq);
-        return;
+        virtio_net_drop_tx_queue_data(q);
+        goto out;
     }
 
     if (unlikely(q->tx_waiting)) {
-        return;
+        goto out;
     }
     q->tx_waiting = 1;
     /* This happens when device was stopped but VCPU wasn't. */
     if (!vdev->vm_running) {
-        return;
+        goto out;
     }
     virtio_queue_set_notification(vq, 0);
     qemu_bh_schedule(q->tx_bh);
+out:
+    aio_context_release(q->ctx);
 }
 
-static void virtio_net_tx_timer(void *opaque)
+static void virtio_net_tx_timer_locked(VirtIONetQueue *q)
 {
-    VirtIONetQueue *q = opaque;
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
@@ -2875,9 +2993,18 @@ static void virtio_net_tx_timer(void *opaque)
     }
 }
 
-static void virtio_net_tx_bh(void *opaque)
+static void virtio_net_tx_timer(void *opaque)
 {
     VirtIONetQueue *q = opaque;
+    AioContext *ctx = q->ctx;
+
+    aio_context_acquire(ctx);
+    virtio_net_tx_timer_locked(q);
+    aio_context_release(ctx);
+}
+
+static void virtio_net_tx_bh_locked(VirtIONetQueue *q)
+{
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
@@ -2924,6 +3051,16 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static void virtio_net_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    AioContext *ctx = q->ctx;
+
+    aio_context_acquire(ctx);
+    virtio_net_tx_bh_locked(q);
+    aio_context_release(ctx);
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2948,6 +3085,7 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
 
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
+    n->vqs[index].ctx = qemu_get_aio_context();
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -2970,6 +3108,252 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
+/*
+ * Move the TX BH or timer of @q to @ctx.  Called from the thread that
+ * currently processes the queue pair, while its virtqueue handlers are
+ * detached.
+ */
+static void virtio_net_queue_set_context(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+
+    if (q->tx_timer) {
+        int64_t expire = timer_expire_time_ns(q->tx_timer);
+
+        timer_free(q->tx_timer);
+        q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                    virtio_net_tx_timer, q);
+        if (expire >= 0) {
+            timer_mod(q->tx_timer, expire);
+        }
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new_guarded(ctx, virtio_net_tx_bh, q,
+                                      &DEVICE(vdev)->mem_reentrancy_guard);
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+    q->ctx = ctx;
+}
+
+static int virtio_net_dataplane_queue_pairs(VirtIONet *n)
+{
+    return n->multiqueue ? n->max_queue_pairs : 1;
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    int index = vq2q(virtio_get_queue_index(q->rx_vq));
+    NetClientState *peer = qemu_get_subqueue(n->nic, index)->peer;
+
+    aio_context_acquire(q->ctx);
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, q->ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, q->ctx);
+
+    /*
+     * Test and clear the notifiers after disabling them, in case the poll
+     * callback didn't have time to run.
+     */
+    virtio_queue_host_notifier_read(virtio_queue_get_host_notifier(q->rx_vq));
+    virtio_queue_host_notifier_read(virtio_queue_get_host_notifier(q->tx_vq));
+
+    if (peer) {
+        peer->info->set_aio_context(peer, NULL);
+    }
+    aio_context_release(q->ctx);
+
+    virtio_net_queue_set_context(q, qemu_get_aio_context());
+}
+
+/*
+ * Hand the queue pairs and their backends over to the IOThreads once
+ * the host notifiers are set up.
+ *
+ * Context: QEMU global mutex held
+ */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int i, r;
+
+    if (!n->net_conf.num_iothreads) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /* IOThreads interrupt the guest through the guest notifiers */
+    n->dataplane_started = true;
+    n->saved_use_guest_notifier_mask = vdev->use_guest_notifier_mask;
+    vdev->use_guest_notifier_mask = false;
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r < 0) {
+        error_report("virtio-net: Failed to set guest notifiers (%d), "
+                     "ensure -accel kvm is set.", r);
+        goto fail_guest_notifiers;
+    }
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0) {
+        goto fail_host_notifiers;
+    }
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+        IOThread *iothread = n->iothreads[i % n->net_conf.num_iothreads];
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   NULL);
+
+        /* Handlers that start running in the IOThread wait for us */
+        aio_context_acquire(ctx);
+        if (peer) {
+            peer->info->set_aio_context(peer, ctx);
+        }
+        virtio_net_queue_set_context(q, ctx);
+
+        /*
+         * The RX handler leaves buffers in the ring until packets arrive,
+         * so only the TX virtqueue is polled.
+         */
+        virtio_queue_aio_attach_host_notifier_no_poll(q->rx_vq, ctx);
+        virtio_queue_aio_attach_host_notifier(q->tx_vq, ctx);
+        aio_context_release(ctx);
+    }
+    return 0;
+
+fail_host_notifiers:
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+fail_guest_notifiers:
+    vdev->use_guest_notifier_mask = n->saved_use_guest_notifier_mask;
+    n->dataplane_started = false;
+    return r;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->dataplane_started) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_wait_bh_oneshot(q->ctx, virtio_net_dataplane_stop_bh, q);
+    }
+
+    virtio_device_stop_ioeventfd_impl(vdev);
+    k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev), false);
+    vdev->use_guest_notifier_mask = n->saved_use_guest_notifier_mask;
+    n->dataplane_started = false;
+}
+
+/* Context: QEMU global mutex held */
+static bool virtio_net_iothreads_setup(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->net_conf.num_iothreads) {
+        return true;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "'guest_rsc_ext' is not supported with iothreads");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "netdev '%s' uses vhost, which cannot be "
+                       "combined with iothreads", peer->name);
+            return false;
+        }
+        if (!peer->info->set_aio_context) {
+            error_setg(errp, "netdev '%s' does not support iothreads",
+                       peer->name);
+            return false;
+        }
+        /* Filters expect to run under the BQL */
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "netdev '%s' has filters, which cannot be "
+                       "combined with iothreads", peer->name);
+            return false;
+        }
+    }
+
+    n->iothreads = g_new0(IOThread *, n->net_conf.num_iothreads);
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        const char *id = n->net_conf.iothread_ids[i];
+        IOThread *iothread = id ? iothread_by_id(id) : NULL;
+
+        if (!iothread) {
+            error_setg(errp, "Cannot find iothread '%s'", id ? id : "");
+            goto fail;
+        }
+        object_ref(OBJECT(iothread));
+        n->iothreads[i] = iothread;
+    }
+
+    /* Keep filters from being added later, see netfilter_complete() */
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        n->nic_conf.peers.ncs[i]->in_iothread = true;
+    }
+    return true;
+
+fail:
+    while (--i >= 0) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    return false;
+}
+
+static void virtio_net_iothreads_cleanup(VirtIONet *n)
+{
+    int i;
+
+    if (!n->iothreads) {
+        return;
+    }
+    for (i = 0; i < n->net_conf.num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+}
+
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -3368,6 +3752,15 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
+
+    if (n->dataplane_started) {
+        /* IOThreads signal the guest notifiers directly */
+        EventNotifier *notifier = idx == VIRTIO_CONFIG_IRQ_IDX ?
+            virtio_config_get_guest_notifier(vdev) :
+            virtio_queue_get_guest_notifier(virtio_get_queue(vdev, idx));
+
+        return event_notifier_test_and_clear(notifier);
+    }
     assert(n->vhost_started);
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) && idx == 2) {
         /* Must guard against invalid features and bogus queue index
@@ -3685,6 +4078,11 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (!virtio_net_iothreads_setup(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3805,10 +4203,18 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_del_queue(vdev, max_queue_pairs * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
     g_free(n->vqs);
+    for (i = 0; n->iothreads && i < n->max_queue_pairs; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (peer) {
+            peer->in_iothread = false;
+        }
+    }
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_iothreads_cleanup(n);
     virtio_cleanup(vdev);
 }
 
@@ -3928,6 +4334,8 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
+    DEFINE_PROP_BIT64("in_order", VirtIONet, host_features,
+                    VIRTIO_F_IN_ORDER, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
@@ -3951,6 +4359,8 @@ static Property virtio_net_properties[] = {
                       VIRTIO_NET_F_GUEST_USO6, true),
     DEFINE_PROP_BIT64("host_uso", VirtIONet, host_features,
                       VIRTIO_NET_F_HOST_USO, true),
+    DEFINE_PROP_ARRAY("iothreads", VirtIONet, net_conf.num_iothreads,
+                      net_conf.iothread_ids, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3981,6 +4391,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->primary_unplug_pending = primary_unplug_pending;
     vdc->get_vhost = virtio_net_get_vhost;
     vdc->toggle_device_iotlb = vhost_toggle_device_iotlb;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
 }
 
 static const TypeInfo virtio_net_info = {
@@ -249,6 +249,22 @@ void hmp_virtio_queue_status(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  shadow_avail_idx:     %d\n",
                        s->shadow_avail_idx);
     }
+    if (s->has_xlate_cache_hits) {
+        monitor_printf(mon, "  xlate_cache_hits:     %"PRIu64"\n",
+                       s->xlate_cache_hits);
+    }
+    if (s->has_xlate_cache_misses) {
+        monitor_printf(mon, "  xlate_cache_misses:   %"PRIu64"\n",
+                       s->xlate_cache_misses);
+    }
+    if (s->has_irq_coalesce_usecs) {
+        monitor_printf(mon, "  irq_coalesce_usecs:   %"PRIu32"\n",
+                       s->irq_coalesce_usecs);
+    }
+    if (s->has_irq_coalesced) {
+        monitor_printf(mon, "  irq_coalesced:        %"PRIu64"\n",
+                       s->irq_coalesced);
+    }
     monitor_printf(mon, "  VRing:\n");
     monitor_printf(mon, "    num:          %"PRId32"\n", s->vring_num);
     monitor_printf(mon, "    num_default:  %"PRId32"\n",
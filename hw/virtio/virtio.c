@@ -16,6 +16,7 @@
 #include "qapi/qapi-commands-virtio.h"
 #include "trace.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -30,6 +31,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -94,11 +96,34 @@ typedef struct VRingUsed
     VRingUsedElem ring[];
 } VRingUsed;
 
+/* Number of guest RAM sections remembered by virtqueue_map_desc() */
+#define VIRTQUEUE_XLATE_CACHE_SIZE 4
+
+/*
+ * A guest RAM section that buffers were recently mapped from.  The entry
+ * holds a reference to @mr, which is dropped when the caches are freed.
+ */
+typedef struct VirtQueueXlateEntry {
+    hwaddr addr;
+    hwaddr size;
+    uint8_t *host;
+    MemoryRegion *mr;
+    bool writable;
+} VirtQueueXlateEntry;
+
 typedef struct VRingMemoryRegionCaches {
     struct rcu_head rcu;
     MemoryRegionCache desc;
     MemoryRegionCache avail;
     MemoryRegionCache used;
+    /*
+     * Buffer translations.  They are only valid for the memory map that
+     * was current when the caches were created, so they are thrown away
+     * together with the ring caches on every memory topology change.
+     * Only accessed from the thread that processes the queue.
+     */
+    VirtQueueXlateEntry xlate[VIRTQUEUE_XLATE_CACHE_SIZE];
+    unsigned int xlate_next;
 } VRingMemoryRegionCaches;
 
 typedef struct VRing
@@ -117,6 +142,26 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/* Elements popped in batches with at most this many buffers are pooled */
+#define VIRTQUEUE_POOL_SG 32
+/* Number of free elements kept around by a pool */
+#define VIRTQUEUE_POOL_SIZE 256
+
+/*
+ * Free elements of one size, recycled by virtqueue_pop_batch().  The pool
+ * outlives its queue until the last element in use is freed.  It is only
+ * accessed from the thread that processes the queue.
+ */
+struct VirtQueueElementPool {
+    size_t sz;
+    size_t alloc_size;
+    /* One for the queue, plus one per element in use */
+    unsigned int refcnt;
+    bool dead;
+    unsigned int n_free;
+    void *free[VIRTQUEUE_POOL_SIZE];
+};
+
 struct VirtQueue
 {
     VRing vring;
@@ -152,6 +197,20 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+    VirtQueueElementPool *elem_pool;
+    uint64_t xlate_hits;
+    uint64_t xlate_misses;
+
+    /* Interrupt coalescing, see virtio_notify_coalesced() */
+    QEMUTimer *coalesce_timer;
+    AioContext *coalesce_ctx;
+    bool coalesce_pending;
+    bool coalesce_irqfd;
+    uint32_t coalesce_frames;
+    uint32_t coalesce_usecs;
+    uint32_t coalesce_window_count;
+    int64_t coalesce_window_start;
+    uint64_t irq_coalesced;
     QLIST_ENTRY(VirtQueue) node;
 };
 
@@ -208,10 +267,17 @@ static const char *virtio_id_to_name(uint16_t device_id)
 /* Called within call_rcu().  */
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
 {
+    int i;
+
     assert(caches != NULL);
     address_space_cache_destroy(&caches->desc);
     address_space_cache_destroy(&caches->avail);
     address_space_cache_destroy(&caches->used);
+    for (i = 0; i < VIRTQUEUE_XLATE_CACHE_SIZE; i++) {
+        if (caches->xlate[i].mr) {
+            memory_region_unref(caches->xlate[i].mr);
+        }
+    }
     g_free(caches);
 }
 
@@ -539,6 +605,13 @@ static void virtio_queue_packed_set_notification(VirtQueue *vq, int enable)
     vring_packed_event_read(vq->vdev, &caches->used, &e);
 
     if (!enable) {
+        /*
+         * Devices disable notifications around every batch they process;
+         * don't dirty the event area if the driver already sees them off.
+         */
+        if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+            return;
+        }
         e.flags = VRING_PACKED_EVENT_FLAG_DISABLE;
     } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         off_wrap = vq->shadow_avail_idx | vq->shadow_avail_wrap_counter << 15;
@@ -606,12 +679,11 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
         smp_rmb();
     }
 
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, addr),
-                              &desc->addr, sizeof(desc->addr));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, id),
-                              &desc->id, sizeof(desc->id));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, len),
-                              &desc->len, sizeof(desc->len));
+    /* addr, len and id are contiguous and read with a single access. */
+    QEMU_BUILD_BUG_ON(offsetof(VRingPackedDesc, flags) !=
+                      offsetof(VRingPackedDesc, id) + sizeof(desc->id));
+    address_space_read_cached(cache, off, desc,
+                              offsetof(VRingPackedDesc, flags));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap16s(vdev, &desc->id);
     virtio_tswap32s(vdev, &desc->len);
@@ -622,17 +694,16 @@ static void vring_packed_desc_write_data(VirtIODevice *vdev,
                                          MemoryRegionCache *cache,
                                          int i)
 {
-    hwaddr off_id = i * sizeof(VRingPackedDesc) +
-                    offsetof(VRingPackedDesc, id);
-    hwaddr off_len = i * sizeof(VRingPackedDesc) +
-                    offsetof(VRingPackedDesc, len);
+    hwaddr off = i * sizeof(VRingPackedDesc) +
+                 offsetof(VRingPackedDesc, len);
+    hwaddr size = offsetof(VRingPackedDesc, flags) -
+                  offsetof(VRingPackedDesc, len);
 
+    /* len and id are contiguous, write them with a single access. */
     virtio_tswap32s(vdev, &desc->len);
     virtio_tswap16s(vdev, &desc->id);
-    address_space_write_cached(cache, off_id, &desc->id, sizeof(desc->id));
-    address_space_cache_invalidate(cache, off_id, sizeof(desc->id));
-    address_space_write_cached(cache, off_len, &desc->len, sizeof(desc->len));
-    address_space_cache_invalidate(cache, off_len, sizeof(desc->len));
+    address_space_write_cached(cache, off, &desc->len, size);
+    address_space_cache_invalidate(cache, off, size);
 }
 
 static void vring_packed_desc_write_flags(VirtIODevice *vdev,
@@ -911,6 +982,56 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER, vq->used_elems mirrors the ring: the element
+ * popped from ring position @slot is recorded there, and it is returned
+ * to the driver from the same position once it and all the elements
+ * before it have been filled.
+ */
+static void virtqueue_ordered_record(VirtQueue *vq, unsigned int slot,
+                                     const VirtQueueElement *elem)
+{
+    vq->used_elems[slot].index = elem->index;
+    vq->used_elems[slot].ndescs = elem->ndescs;
+    vq->used_elems[slot].in_order_filled = false;
+}
+
+static unsigned int virtqueue_ordered_first(VirtQueue *vq)
+{
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return vq->used_idx;
+    }
+    return vq->used_idx % vq->vring.num;
+}
+
+static void virtqueue_ordered_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                   unsigned int len)
+{
+    unsigned int i = virtqueue_ordered_first(vq);
+    unsigned int steps = 0;
+
+    /* Only the descriptors in use can hold the element. */
+    while (steps < vq->inuse) {
+        VirtQueueElement *e = &vq->used_elems[i];
+
+        if (e->index == elem->index && !e->in_order_filled) {
+            e->len = len;
+            e->in_order_full = len >= iov_size(elem->in_sg, elem->in_num);
+            e->in_order_filled = true;
+            return;
+        }
+
+        steps += MAX(e->ndescs, 1);
+        i += MAX(e->ndescs, 1);
+        if (i >= vq->vring.num) {
+            i -= vq->vring.num;
+        }
+    }
+
+    qemu_log_mask(LOG_GUEST_ERROR, "%s: %s cannot fill buffer id %u\n",
+                  __func__, vq->vdev->name, elem->index);
+}
+
 /* Called within rcu_read_lock().  */
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
@@ -923,7 +1044,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_fill(vq, elem, len);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_fill(vq, elem, len, idx);
     } else {
         virtqueue_split_fill(vq, elem, len, idx);
@@ -952,18 +1075,112 @@ static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
 
 static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
 {
-    unsigned int i, ndescs = 0;
+    unsigned int i, ndescs;
 
     if (unlikely(!vq->vring.desc)) {
         return;
     }
 
+    /*
+     * The driver skips over all the descriptors of a used buffer, so each
+     * used element goes where the previous one's descriptors end.
+     */
+    ndescs = vq->used_elems[0].ndescs;
     for (i = 1; i < count; i++) {
-        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], i, false);
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
         ndescs += vq->used_elems[i].ndescs;
     }
     virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
-    ndescs += vq->used_elems[0].ndescs;
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
+}
+
+/* Called within rcu_read_lock().  */
+static void virtqueue_ordered_split_flush(VirtQueue *vq)
+{
+    unsigned int i = vq->used_idx % vq->vring.num;
+    unsigned int count = 0;
+
+    if (unlikely(!vq->vring.used)) {
+        return;
+    }
+
+    while (count < vq->inuse && vq->used_elems[i].in_order_filled) {
+        VirtQueueElement *e = &vq->used_elems[i];
+
+        /* virtqueue_split_fill() takes the position relative to used_idx */
+        virtqueue_split_fill(vq, e, e->len, count);
+        e->in_order_filled = false;
+        count++;
+        if (++i == vq->vring.num) {
+            i = 0;
+        }
+    }
+
+    if (count) {
+        /* One index update for everything that became ready. */
+        virtqueue_split_flush(vq, count);
+    }
+}
+
+/*
+ * Called within rcu_read_lock().  Consecutive completed buffers are
+ * returned with a single used descriptor carrying the id of the last one,
+ * as allowed by VIRTIO_F_IN_ORDER.  A buffer whose writable part was not
+ * completely written ends such a batch, so that the driver does not
+ * need the length of any buffer but the last one of each batch.
+ */
+static void virtqueue_ordered_packed_flush(VirtQueue *vq)
+{
+    unsigned int i = vq->used_idx;
+    unsigned int ndescs = 0, start = 0;
+    VirtQueueElement first = {};
+    bool have_first = false;
+
+    if (unlikely(!vq->vring.desc)) {
+        return;
+    }
+
+    while (ndescs < vq->inuse && vq->used_elems[i].in_order_filled) {
+        VirtQueueElement *e = &vq->used_elems[i];
+        unsigned int next = i + e->ndescs;
+
+        if (next >= vq->vring.num) {
+            next -= vq->vring.num;
+        }
+        e->in_order_filled = false;
+        ndescs += e->ndescs;
+        i = next;
+
+        if (e->in_order_full && ndescs < vq->inuse &&
+            vq->used_elems[next].in_order_filled) {
+            continue;
+        }
+
+        /*
+         * Last buffer of a batch, written where the batch starts.  The
+         * first used descriptor of the flush is written last, after a
+         * barrier, so that the driver also sees all the following ones.
+         */
+        if (have_first) {
+            virtqueue_packed_fill_desc(vq, e, start, false);
+        } else {
+            first = *e;
+            have_first = true;
+        }
+        start = ndescs;
+    }
+
+    if (!have_first) {
+        return;
+    }
+    virtqueue_packed_fill_desc(vq, &first, 0, true);
 
     vq->inuse -= ndescs;
     vq->used_idx += ndescs;
@@ -981,7 +1198,14 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        /* Whatever is ready is returned, regardless of @count. */
+        if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+            virtqueue_ordered_packed_flush(vq);
+        } else {
+            virtqueue_ordered_split_flush(vq);
+        }
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
         virtqueue_split_flush(vq, count);
@@ -996,6 +1220,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: the elements to return to the guest
+ * @lens: number of bytes written to each element, or NULL if none
+ * @num: number of elements
+ *
+ * Publish @num used elements with a single index update and write
+ * barrier.  The caller then decides once whether to notify the guest.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int num)
+{
+    unsigned int i;
+
+    if (num == 0) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, num);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1365,11 +1614,99 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/*
+ * Look up @pa in the translation cache, filling a slot on a miss.  On
+ * success, returns a host pointer for @pa with a reference to the memory
+ * region taken as address_space_map() would, and clamps *@len to the
+ * cached section.  Returns NULL if @pa is not in RAM that can be accessed
+ * directly; the caller then goes through dma_memory_map(), which handles
+ * MMIO and bounce buffering.
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_xlate_map(VirtQueue *vq,
+                                 VRingMemoryRegionCaches *caches,
+                                 hwaddr pa, hwaddr *len, bool is_write)
+{
+    VirtQueueXlateEntry *e;
+    MemoryRegionSection section;
+    uint8_t *host;
+    hwaddr end;
+    int i;
+
+    if (xen_enabled()) {
+        /* Guest RAM is only mapped on demand by the map cache */
+        return NULL;
+    }
+
+    for (i = 0; i < VIRTQUEUE_XLATE_CACHE_SIZE; i++) {
+        e = &caches->xlate[i];
+        if (e->mr && pa - e->addr < e->size && (e->writable || !is_write)) {
+            vq->xlate_hits++;
+            goto hit;
+        }
+    }
+
+    vq->xlate_misses++;
+
+    /*
+     * Look up everything from @pa to the end of the flat range that
+     * contains it, so that one entry covers whole buffers and the ones
+     * that follow them in the same RAM section.
+     */
+    section = memory_region_find(vq->vdev->dma_as->root, pa, UINT64_MAX - pa);
+    if (!section.mr) {
+        return NULL;
+    }
+    if (section.offset_within_address_space != pa ||
+        !memory_access_is_direct(section.mr, is_write)) {
+        /* @pa is not mapped, or not RAM */
+        memory_region_unref(section.mr);
+        return NULL;
+    }
+    host = (uint8_t *)memory_region_get_ram_ptr(section.mr) +
+           section.offset_within_region;
+    end = pa + int128_get64(section.size);
+
+    /*
+     * An entry that ends at the same place is from the same flat range,
+     * further up than @pa; extend it downwards.
+     */
+    for (i = 0; i < VIRTQUEUE_XLATE_CACHE_SIZE; i++) {
+        e = &caches->xlate[i];
+        if (e->mr == section.mr && e->addr + e->size == end) {
+            memory_region_unref(section.mr);
+            e->size = end - pa;
+            e->addr = pa;
+            e->host = host;
+            goto hit;
+        }
+    }
+
+    e = &caches->xlate[caches->xlate_next];
+    caches->xlate_next = (caches->xlate_next + 1) % VIRTQUEUE_XLATE_CACHE_SIZE;
+    if (e->mr) {
+        memory_region_unref(e->mr);
+    }
+    e->addr = pa;
+    e->size = end - pa;
+    e->host = host;
+    e->mr = section.mr;
+    e->writable = memory_access_is_direct(section.mr, true);
+
+hit:
+    *len = MIN(*len, e->addr + e->size - pa);
+    memory_region_ref(e->mr);
+    return e->host + (pa - e->addr);
+}
+
+static bool virtqueue_map_desc(VirtQueue *vq, VRingMemoryRegionCaches *caches,
+                               unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
+    VirtIODevice *vdev = vq->vdev;
     bool ok = false;
     unsigned num_sg = *p_num_sg;
     assert(num_sg <= max_num_sg);
@@ -1388,11 +1725,16 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtqueue_xlate_map(vq, caches, pa, &len,
+                                                   is_write);
+        if (!iov[num_sg].iov_base) {
+            len = sz;
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE,
+                                                  MEMTXATTRS_UNSPECIFIED);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1461,7 +1803,19 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static size_t virtqueue_element_size(size_t sz, unsigned out_num,
+                                     unsigned in_num)
+{
+    VirtQueueElement *elem;
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t out_addr_end = in_addr_ofs + (in_num + out_num) * sizeof(hwaddr);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
+
+    return in_sg_ofs + (in_num + out_num) * sizeof(struct iovec);
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num,
+                                     VirtQueueElementPool *pool)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1472,7 +1826,14 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (pool && pool->sz == sz && out_num + in_num <= VIRTQUEUE_POOL_SG) {
+        elem = pool->n_free ? pool->free[--pool->n_free]
+                            : g_malloc(pool->alloc_size);
+        pool->refcnt++;
+    } else {
+        elem = g_malloc(out_sg_end);
+        pool = NULL;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1480,13 +1841,96 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->pool = pool;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
 {
-    unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
+    if (--pool->refcnt == 0) {
+        g_free(pool);
+    }
+}
+
+static VirtQueueElementPool *virtqueue_get_element_pool(VirtQueue *vq,
+                                                        size_t sz)
+{
+    VirtQueueElementPool *pool = vq->elem_pool;
+
+    if (!pool) {
+        pool = g_new0(VirtQueueElementPool, 1);
+        pool->sz = sz;
+        pool->alloc_size = virtqueue_element_size(sz, VIRTQUEUE_POOL_SG, 0);
+        pool->refcnt = 1;
+        vq->elem_pool = pool;
+    }
+    return pool;
+}
+
+static void virtqueue_release_element_pool(VirtQueue *vq)
+{
+    VirtQueueElementPool *pool = vq->elem_pool;
+
+    if (!pool) {
+        return;
+    }
+    while (pool->n_free) {
+        g_free(pool->free[--pool->n_free]);
+    }
+    pool->dead = true;
+    vq->elem_pool = NULL;
+    virtqueue_element_pool_unref(pool);
+}
+
+/* virtqueue_element_free:
+ * @elem: The #VirtQueueElement
+ *
+ * Free an element returned by virtqueue_pop(), virtqueue_pop_batch() or
+ * qemu_get_virtqueue_element().  Elements from virtqueue_pop_batch() may
+ * come from a pool, in which case they must be freed with this function,
+ * in the thread that processes the queue.
+ */
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueueElementPool *pool = elem->pool;
+
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+
+    if (!pool->dead && pool->n_free < VIRTQUEUE_POOL_SIZE) {
+        pool->free[pool->n_free++] = elem;
+    } else {
+        g_free(elem);
+    }
+    virtqueue_element_pool_unref(pool);
+}
+
+/* Called within rcu_read_lock().  */
+static VRingMemoryRegionCaches *virtqueue_split_get_caches(VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+    return caches;
+}
+
+/* Called within rcu_read_lock().  */
+static VirtQueueElement *virtqueue_split_pop_head(VirtQueue *vq, size_t sz,
+                                                  unsigned int head,
+                                                  VRingMemoryRegionCaches *caches,
+                                                  VirtQueueElementPool *pool)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1498,45 +1942,12 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
     max = vq->vring.num;
-
-    if (vq->inuse >= vq->vring.num) {
-        virtio_error(vdev, "Virtqueue size exceeded");
-        goto done;
-    }
-
-    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
-        goto done;
-    }
-
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1564,7 +1975,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, caches, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1573,7 +1984,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, caches, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1595,7 +2006,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(sz, out_num, in_num, pool);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1609,6 +2020,12 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     vq->inuse++;
 
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        /* The caller already moved past the head. */
+        virtqueue_ordered_record(vq, (vq->last_avail_idx - 1) % vq->vring.num,
+                                 elem);
+    }
+
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
 done:
     address_space_cache_destroy(&indirect_desc_cache);
@@ -1620,7 +2037,125 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtIODevice *vdev = vq->vdev;
+    unsigned int head;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
+        return NULL;
+    }
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    caches = virtqueue_split_get_caches(vq);
+    if (!caches) {
+        return NULL;
+    }
+
+    return virtqueue_split_pop_head(vq, sz, head, caches, NULL);
+}
+
+/*
+ * Called within rcu_read_lock().  Read the @num heads advertised from @idx
+ * on with at most two copies, rather than one access per head.
+ */
+static bool virtqueue_split_get_heads(VirtQueue *vq,
+                                      VRingMemoryRegionCaches *caches,
+                                      unsigned int idx, uint16_t *heads,
+                                      unsigned int num)
+{
+    unsigned int start = idx % vq->vring.num;
+    unsigned int first = MIN(num, vq->vring.num - start);
+    unsigned int i;
+
+    if (address_space_read_cached(&caches->avail,
+                                  offsetof(VRingAvail, ring[start]),
+                                  heads, first * sizeof(heads[0])) ||
+        (num > first &&
+         address_space_read_cached(&caches->avail,
+                                   offsetof(VRingAvail, ring[0]),
+                                   heads + first,
+                                   (num - first) * sizeof(heads[0])))) {
+        virtio_error(vq->vdev, "Cannot read available ring");
+        return false;
+    }
+
+    for (i = 0; i < num; i++) {
+        heads[i] = virtio_lduw_p(vq->vdev, &heads[i]);
+    }
+    return true;
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              VirtQueueElement **elems,
+                                              unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueElementPool *pool;
+    uint16_t heads[VIRTQUEUE_MAX_SIZE];
+    unsigned int i, n = 0;
+    int num;
+
+    RCU_READ_LOCK_GUARD();
+
+    /* A single load of the avail index, and barrier, for the batch. */
+    num = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num <= 0) {
+        return 0;
+    }
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        return 0;
+    }
+    num = MIN(num, MIN(max, vq->vring.num - vq->inuse));
+
+    caches = virtqueue_split_get_caches(vq);
+    if (!caches || !virtqueue_split_get_heads(vq, caches, vq->last_avail_idx,
+                                              heads, num)) {
+        return 0;
+    }
+
+    pool = virtqueue_get_element_pool(vq, sz);
+    for (i = 0; i < num; i++) {
+        if (heads[i] >= vq->vring.num) {
+            virtio_error(vdev, "Guest says index %u is available", heads[i]);
+            break;
+        }
+        vq->last_avail_idx++;
+        elems[n] = virtqueue_split_pop_head(vq, sz, heads[i], caches, pool);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz,
+                                  VirtQueueElementPool *pool)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1692,7 +2227,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, caches, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1701,7 +2236,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, caches, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1721,7 +2256,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(sz, out_num, in_num, pool);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1733,6 +2268,9 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     elem->index = id;
     elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_record(vq, vq->last_avail_idx, elem);
+    }
     vq->last_avail_idx += elem->ndescs;
     vq->inuse += elem->ndescs;
 
@@ -1762,12 +2300,75 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, NULL);
     } else {
         return virtqueue_split_pop(vq, sz);
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: the size of the elements, as for virtqueue_pop()
+ * @elems: array to store the elements in
+ * @max: the size of @elems
+ *
+ * Pop up to @max elements at once.  For split rings, the available index
+ * is only read once and the heads of the batch are read together before
+ * their descriptors are mapped.  Elements are allocated from a per-queue
+ * pool, and must be released with virtqueue_element_free().
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev) || max == 0) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        elems[n] = virtqueue_packed_pop(vq, sz,
+                                        virtqueue_get_element_pool(vq, sz));
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+/* virtqueue_unpop_batch:
+ * @vq: The #VirtQueue
+ * @elems: the most recently popped elements, in the order they were popped
+ * @num: number of elements in @elems
+ *
+ * Like virtqueue_unpop() for the tail of a batch that could not be
+ * processed.  The elements are not freed.
+ */
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                           unsigned int num)
+{
+    unsigned int i, ndescs = 0;
+
+    for (i = 0; i < num; i++) {
+        ndescs += elems[i]->ndescs;
+        virtqueue_detach_element(vq, elems[i], 0);
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_rewind(vq, ndescs);
+    } else {
+        virtqueue_split_rewind(vq, ndescs);
+    }
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1805,6 +2406,10 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
                                                vq->vring.num, &idx, false)) {
             ++elem.ndescs;
         }
+        vq->inuse += elem.ndescs;
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, vq->last_avail_idx, &elem);
+        }
         /*
          * immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0.
@@ -1840,6 +2445,10 @@ static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
         if (fEventIdx) {
             vring_set_avail_event(vq, vq->last_avail_idx);
         }
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, (vq->last_avail_idx - 1) %
+                                     vq->vring.num, &elem);
+        }
         /* immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0 */
         virtqueue_push(vq, &elem, 0);
@@ -1903,7 +2512,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num, NULL);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2054,6 +2663,22 @@ static enum virtio_device_endian virtio_current_cpu_endian(void)
     }
 }
 
+static void virtio_queue_coalesce_reset(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    vq->coalesce_ctx = NULL;
+    vq->coalesce_pending = false;
+    vq->coalesce_frames = 0;
+    vq->coalesce_usecs = vdev->irq_coalesce_adaptive ?
+                         0 : vdev->irq_coalesce_usecs;
+    vq->coalesce_window_count = 0;
+    vq->coalesce_window_start = 0;
+    vq->irq_coalesced = 0;
+}
+
 static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
 {
     vdev->vq[i].vring.desc = 0;
@@ -2071,6 +2696,13 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    if (vdev->vq[i].used_elems) {
+        memset(vdev->vq[i].used_elems, 0,
+               sizeof(VirtQueueElement) * vdev->vq[i].vring.num_default);
+    }
+    vdev->vq[i].xlate_hits = 0;
+    vdev->vq[i].xlate_misses = 0;
+    virtio_queue_coalesce_reset(vdev, &vdev->vq[i]);
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2177,6 +2809,14 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
         num < 0) {
         return;
     }
+    /*
+     * With VIRTIO_F_IN_ORDER, used_elems is indexed by ring slot, and it
+     * only has room for the default size.
+     */
+    if (num > vdev->vq[n].vring.num_default &&
+        virtio_host_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        return;
+    }
     vdev->vq[n].vring.num = num;
 }
 
@@ -2325,6 +2965,8 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_release_element_pool(vq);
+    virtio_queue_coalesce_reset(vq->vdev, vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2406,6 +3048,14 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     v = vq->signalled_used_valid;
     vq->signalled_used_valid = true;
 
+    /*
+     * With VIRTIO_F_IN_ORDER a completion may be held back until earlier
+     * buffers complete; don't interrupt the driver if nothing was used.
+     */
+    if (v && new == old && virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        return false;
+    }
+
     if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
         return false;
     } else if (e.flags == VRING_PACKED_EVENT_FLAG_ENABLE) {
@@ -2426,16 +3076,8 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_irqfd(VirtQueue *vq)
 {
-    WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
-            return;
-        }
-    }
-
-    trace_virtio_notify_irqfd(vdev, vq);
-
     /*
      * virtio spec 1.0 says ISR bit 0 should be ignored with MSI, but
      * windows drivers included in virtio-win 1.8.0 (circa 2015) are
@@ -2461,8 +3103,187 @@ static void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
+static void virtio_coalesce_fire(VirtQueue *vq)
+{
+    VirtIODevice *vdev = vq->vdev;
+
+    trace_virtio_notify_coalesced(vdev, vq, vq->coalesce_frames,
+                                  vq->coalesce_usecs);
+    /* The interrupt covers every buffer used so far */
+    vq->signalled_used = vq->used_idx;
+    vq->coalesce_pending = false;
+    vq->coalesce_frames = 0;
+    if (vq->coalesce_irqfd) {
+        virtio_irqfd(vq);
+    } else {
+        virtio_irq(vq);
+    }
+}
+
+static void virtio_coalesce_timer_cb(void *opaque)
+{
+    VirtQueue *vq = opaque;
+    AioContext *ctx = vq->coalesce_ctx;
+
+    aio_context_acquire(ctx);
+    if (vq->coalesce_pending) {
+        virtio_coalesce_fire(vq);
+    }
+    aio_context_release(ctx);
+}
+
+/*
+ * Adaptive mode picks the delay from the rate of notifications seen in
+ * the last window, much like adaptive interrupt moderation on NICs: a
+ * queue that completes fewer than VIRTIO_COALESCE_RATE_LOW batches per
+ * window gets its interrupts immediately, a busier one waits longer,
+ * up to irq-coalesce-usecs at VIRTIO_COALESCE_RATE_HIGH.
+ */
+#define VIRTIO_COALESCE_WINDOW_NS   SCALE_MS
+#define VIRTIO_COALESCE_RATE_LOW    8
+#define VIRTIO_COALESCE_RATE_HIGH   64
+#define VIRTIO_COALESCE_MAX_USECS   10000
+
+static void virtio_coalesce_sample(VirtIODevice *vdev, VirtQueue *vq,
+                                   int64_t now)
+{
+    int64_t elapsed = now - vq->coalesce_window_start;
+    uint64_t rate;
+
+    vq->coalesce_window_count++;
+    if (elapsed < VIRTIO_COALESCE_WINDOW_NS) {
+        return;
+    }
+
+    if (!vdev->irq_coalesce_adaptive) {
+        vq->coalesce_usecs = vdev->irq_coalesce_usecs;
+    } else {
+        rate = (uint64_t)vq->coalesce_window_count *
+               VIRTIO_COALESCE_WINDOW_NS / elapsed;
+        if (rate < VIRTIO_COALESCE_RATE_LOW) {
+            vq->coalesce_usecs = 0;
+        } else {
+            vq->coalesce_usecs = MIN((uint64_t)vdev->irq_coalesce_usecs,
+                                     vdev->irq_coalesce_usecs * rate /
+                                     VIRTIO_COALESCE_RATE_HIGH);
+        }
+    }
+    vq->coalesce_window_start = now;
+    vq->coalesce_window_count = 0;
+}
+
+/*
+ * Called instead of injecting the interrupt right away when the device
+ * has irq-coalesce-usecs set.  The first notification the guest asked
+ * for arms a timer; the ones that follow are merged into it until the
+ * timer expires or irq-coalesce-frames of them have accumulated.
+ *
+ * The timer lives in the AioContext of the thread that processes the
+ * queue.  If the queue moved to another thread, the old timer is no
+ * longer armed by anybody and is simply replaced.
+ *
+ * The timer runs on the virtual clock, which stands still while the VM
+ * is stopped.  Requests still complete then, e.g. while do_vm_stop()
+ * drains the block layer, so their interrupts go out right away: held
+ * back interrupts are not migrated.
+ */
+static void virtio_notify_coalesced(VirtIODevice *vdev, VirtQueue *vq,
+                                    bool irqfd)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    virtio_coalesce_sample(vdev, vq, now);
+
+    if (vq->coalesce_pending && vq->coalesce_ctx == ctx) {
+        vq->irq_coalesced++;
+        if (++vq->coalesce_frames >= vdev->irq_coalesce_frames) {
+            timer_del(vq->coalesce_timer);
+            virtio_coalesce_fire(vq);
+        }
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(vdev, vq) && !vq->coalesce_pending) {
+            return;
+        }
+    }
+
+    if (vq->coalesce_ctx != ctx) {
+        if (vq->coalesce_timer) {
+            timer_free(vq->coalesce_timer);
+        }
+        vq->coalesce_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                           virtio_coalesce_timer_cb, vq);
+        vq->coalesce_ctx = ctx;
+    }
+
+    vq->coalesce_irqfd = irqfd;
+    vq->coalesce_frames = 1;
+    if (!vq->coalesce_usecs || vdev->irq_coalesce_frames <= 1 ||
+        !vdev->vm_running) {
+        virtio_coalesce_fire(vq);
+        return;
+    }
+
+    vq->coalesce_pending = true;
+    timer_mod(vq->coalesce_timer, now + vq->coalesce_usecs * SCALE_US);
+}
+
+/*
+ * Send the interrupts that are still held back by coalescing.  The
+ * queue may be processed by an IOThread that is in
+ * virtio_notify_coalesced() right now, so take its AioContext.
+ */
+static void virtio_coalesce_flush(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        VirtQueue *vq = &vdev->vq[i];
+        AioContext *ctx = vq->coalesce_ctx;
+
+        if (vq->vring.num == 0) {
+            break;
+        }
+        if (!ctx) {
+            continue;
+        }
+        aio_context_acquire(ctx);
+        if (vq->coalesce_pending) {
+            timer_del(vq->coalesce_timer);
+            vq->coalesce_irqfd = false;
+            virtio_coalesce_fire(vq);
+        }
+        aio_context_release(ctx);
+    }
+}
+
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (vdev->irq_coalesce_usecs) {
+        virtio_notify_coalesced(vdev, vq, true);
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(vdev, vq)) {
+            return;
+        }
+    }
+
+    trace_virtio_notify_irqfd(vdev, vq);
+    virtio_irqfd(vq);
+}
+
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (vdev->irq_coalesce_usecs) {
+        virtio_notify_coalesced(vdev, vq, false);
+        return;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
             return;
@@ -2940,6 +3761,67 @@ size_t virtio_get_config_size(const VirtIOConfigSizeParams *params,
     return config_size;
 }
 
+/*
+ * The elements in flight at migration time are not recorded in
+ * used_elems; for in-order split rings they are the heads between the
+ * used and the last available index.
+ */
+static void virtqueue_split_ordered_restore(VirtQueue *vq)
+{
+    VirtQueueElement elem = { .ndescs = 1 };
+    uint16_t idx;
+
+    RCU_READ_LOCK_GUARD();
+    for (idx = vq->used_idx; idx != vq->last_avail_idx; idx++) {
+        elem.index = vring_avail_ring(vq, idx % vq->vring.num);
+        virtqueue_ordered_record(vq, idx % vq->vring.num, &elem);
+    }
+}
+
+/*
+ * Likewise for packed rings, where the descriptors in flight are still
+ * in the ring, starting at the used index.  As in virtqueue_packed_pop,
+ * an element is identified by the id of its first descriptor and uses
+ * one slot per descriptor of its chain.
+ */
+static void virtqueue_packed_ordered_restore(VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches;
+    VRingPackedDesc desc;
+    VirtQueueElement elem;
+    unsigned int slot = vq->used_idx;
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    caches = vring_get_region_caches(vq);
+    if (!caches ||
+        caches->desc.len < vq->vring.num * sizeof(VRingPackedDesc)) {
+        return;
+    }
+
+    while (n < vq->inuse && n < vq->vring.num) {
+        unsigned int head = slot;
+
+        elem.ndescs = 0;
+        do {
+            vring_packed_desc_read(vq->vdev, &desc, &caches->desc, slot,
+                                   true);
+            if (!elem.ndescs) {
+                elem.index = desc.id;
+            }
+            elem.ndescs++;
+            if (++slot >= vq->vring.num) {
+                slot = 0;
+            }
+        } while (!(desc.flags & VRING_DESC_F_INDIRECT) &&
+                 (desc.flags & VRING_DESC_F_NEXT) &&
+                 n + elem.ndescs < vq->vring.num);
+
+        virtqueue_ordered_record(vq, head, &elem);
+        n += elem.ndescs;
+    }
+}
+
 int coroutine_mixed_fn
 virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 {
@@ -3083,6 +3965,16 @@ virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
         if (vdev->vq[i].vring.desc) {
             uint16_t nheads;
 
+            /* See virtio_queue_set_num() */
+            if (vdev->vq[i].vring.num > vdev->vq[i].vring.num_default &&
+                virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+                error_report("VQ %d size 0x%x larger than 0x%x is not "
+                             "supported with in-order completion",
+                             i, vdev->vq[i].vring.num,
+                             vdev->vq[i].vring.num_default);
+                return -1;
+            }
+
             /*
              * VIRTIO-1 devices migrate desc, used, and avail ring addresses so
              * only the region cache needs to be set up.  Legacy devices need
@@ -3099,6 +3991,9 @@ virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                 vdev->vq[i].shadow_avail_idx = vdev->vq[i].last_avail_idx;
                 vdev->vq[i].shadow_avail_wrap_counter =
                                         vdev->vq[i].last_avail_wrap_counter;
+                if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+                    virtqueue_packed_ordered_restore(&vdev->vq[i]);
+                }
                 continue;
             }
 
@@ -3134,6 +4029,9 @@ virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                              vdev->vq[i].used_idx);
                 return -1;
             }
+            if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+                virtqueue_split_ordered_restore(&vdev->vq[i]);
+            }
         }
     }
 
@@ -3170,6 +4068,8 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
 
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
+        /* Do not carry held back interrupts across stop or migration */
+        virtio_coalesce_flush(vdev);
     }
 }
 
@@ -3633,6 +4533,16 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
     /* Devices should either use vmsd or the load/save methods */
     assert(!vdc->vmsd || !vdc->load);
 
+    if (vdev->irq_coalesce_usecs > VIRTIO_COALESCE_MAX_USECS) {
+        error_setg(errp, "irq-coalesce-usecs must not exceed %d",
+                   VIRTIO_COALESCE_MAX_USECS);
+        return;
+    }
+    if (vdev->irq_coalesce_usecs && !vdev->irq_coalesce_frames) {
+        error_setg(errp, "irq-coalesce-frames must be at least 1");
+        return;
+    }
+
     if (vdc->realize != NULL) {
         vdc->realize(dev, &err);
         if (err != NULL) {
@@ -3682,6 +4592,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        virtio_queue_coalesce_reset(vdev, &vdev->vq[i]);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
     g_free(vdev->vq);
@@ -3703,10 +4614,16 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("irq-coalesce-usecs", VirtIODevice,
+                       irq_coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("irq-coalesce-frames", VirtIODevice,
+                       irq_coalesce_frames, 32),
+    DEFINE_PROP_BOOL("irq-coalesce-adaptive", VirtIODevice,
+                     irq_coalesce_adaptive, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3776,7 +4693,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -3906,6 +4823,14 @@ VirtQueueStatus *qmp_x_query_virtio_queue_status(const char *path,
         status->has_last_avail_idx = true;
         status->last_avail_idx = vdev->vq[queue].last_avail_idx;
         status->shadow_avail_idx = vdev->vq[queue].shadow_avail_idx;
+        status->has_xlate_cache_hits = true;
+        status->has_xlate_cache_misses = true;
+        status->xlate_cache_hits = vdev->vq[queue].xlate_hits;
+        status->xlate_cache_misses = vdev->vq[queue].xlate_misses;
+        status->has_irq_coalesce_usecs = true;
+        status->has_irq_coalesced = true;
+        status->irq_coalesce_usecs = vdev->vq[queue].coalesce_usecs;
+        status->irq_coalesced = vdev->vq[queue].irq_coalesced;
     }
 
     return status;
@@ -66,6 +66,9 @@
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/* remember up to 8 large pages per mmu_idx for refilling subpages */
+#define CPU_LPTLB_SIZE 8
+
 #define CPU_TLB_DYN_MIN_BITS 6
 #define CPU_TLB_DYN_DEFAULT_BITS 8
 
@@ -142,6 +145,21 @@ typedef struct CPUTLBEntryFull {
 #endif /* CONFIG_SOFTMMU */
 
 #if defined(CONFIG_SOFTMMU) && defined(CONFIG_TCG)
+/*
+ * A large page, as passed to tlb_set_page_full.  The fast path only ever
+ * maps TARGET_PAGE_SIZE, so this is used to refill further subpages of
+ * the same large page without another call into the target's tlb_fill,
+ * and to invalidate exactly those subpages when the large page is flushed.
+ */
+typedef struct CPUTLBLargePage {
+    /* Virtual base of the large page, or -1 if unused. */
+    vaddr addr;
+    /* ~(size - 1), or 0 if unused. */
+    vaddr mask;
+    /* As passed to tlb_set_page_full, with @phys_addr of the page base. */
+    CPUTLBEntryFull full;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -166,6 +184,14 @@ typedef struct CPUTLBDesc {
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
+    /*
+     * The large pages installed since the last flush.  If more than
+     * CPU_LPTLB_SIZE have been installed, @lpoverflow is set and we
+     * fall back to large_page_addr/mask for invalidation.
+     */
+    size_t lpindex;
+    bool lpoverflow;
+    CPUTLBLargePage lptlb[CPU_LPTLB_SIZE];
 } CPUTLBDesc;
 
 /*
@@ -188,6 +214,10 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Subpage fills served from lptlb instead of the target's tlb_fill. */
+    size_t lp_fill_count;
+    /* Large pages invalidated without flushing the whole mmu_idx. */
+    size_t lp_flush_count;
 } CPUTLBCommon;
 
 /*
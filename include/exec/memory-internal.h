@@ -45,5 +45,6 @@ void address_space_dispatch_free(AddressSpaceDispatch *d);
 
 void mtree_print_dispatch(struct AddressSpaceDispatch *d,
                           MemoryRegion *root);
+void mtree_print_dispatch_cache(struct AddressSpaceDispatch *d);
 #endif
 #endif
@@ -1099,6 +1099,8 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+    /* Set during memory_region_transaction_commit() */
+    bool flatview_changed;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1115,6 +1117,10 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    /* MemoryRegions visited while rendering; protected by the BQL */
+    GHashTable *rendered;
+    /* A rendered region changed, regenerate on the next commit */
+    bool stale;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
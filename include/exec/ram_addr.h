@@ -23,6 +23,7 @@
 #include "cpu.h"
 #include "sysemu/xen.h"
 #include "sysemu/tcg.h"
+#include "qemu/cutils.h"
 #include "exec/ramlist.h"
 #include "exec/ramblock.h"
 
@@ -335,6 +336,9 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
 
 #if !defined(_WIN32)
 
+/* Clean runs skipped by cpu_physical_memory_set_dirty_lebitmap(), in words */
+#define DIRTY_LEBITMAP_SKIP_WORDS 64
+
 /*
  * Contrary to cpu_physical_memory_sync_dirty_bitmap() this function returns
  * the number of dirty pages in @bitmap passed as argument. On the other hand,
@@ -375,6 +379,23 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
             }
 
             for (k = 0; k < nr; k++) {
+                /*
+                 * Dirty bitmaps are mostly sparse, skip runs of clean
+                 * pages with the vectorized buffer_is_zero().
+                 */
+                if (!(k % DIRTY_LEBITMAP_SKIP_WORDS) &&
+                    nr - k >= DIRTY_LEBITMAP_SKIP_WORDS &&
+                    buffer_is_zero(bitmap + k, DIRTY_LEBITMAP_SKIP_WORDS *
+                                               sizeof(unsigned long))) {
+                    k += DIRTY_LEBITMAP_SKIP_WORDS - 1;
+                    offset += DIRTY_LEBITMAP_SKIP_WORDS;
+                    while (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+                        offset -= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+                        idx++;
+                    }
+                    continue;
+                }
+
                 if (bitmap[k]) {
                     unsigned long temp = leul_to_cpu(bitmap[k]);
 
@@ -23,4 +23,16 @@
  */
 void tb_flush(CPUState *cs);
 
+/**
+ * tb_direct_ram_watchpoint() - account for a read watchpoint
+ * @cs: CPUState
+ * @inserted: true if the watchpoint was inserted, false if removed
+ *
+ * With -accel tcg,direct-ram=on, translated code may load from guest RAM
+ * without a TLB lookup.  Translation blocks are shared by all CPUs, so
+ * the direct RAM window is disabled while any CPU has a read watchpoint;
+ * inserting the first one flushes the translations that use it.
+ */
+void tb_direct_ram_watchpoint(CPUState *cs, bool inserted);
+
 #endif /* _TB_FLUSH_H_ */
@@ -78,6 +78,7 @@ struct TranslationBlock {
 #define CF_PARALLEL      0x00080000 /* Generate code for a parallel context */
 #define CF_NOIRQ         0x00100000 /* Generate an uninterruptible TB */
 #define CF_PCREL         0x00200000 /* Opcodes in TB are PC-relative */
+#define CF_PLUGIN_OFF    0x00400000 /* Plugin instrumentation sampled out */
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -59,6 +59,8 @@ typedef struct {
     int size[2];
     int align[2];
     const char *name;
+    /* target and host representations are bit-for-bit the same */
+    bool identical;
 } StructEntry;
 
 /* Translation table for bitmasks... */
@@ -75,6 +77,7 @@ void thunk_register_struct_direct(int id, const char *name,
 const argtype *thunk_convert(void *dst, const void *src,
                              const argtype *type_ptr, int to_host);
 const argtype *thunk_print(void *arg, const argtype *type_ptr);
+bool thunk_type_identical(const argtype *type_ptr);
 
 extern StructEntry *struct_entries;
 
@@ -398,6 +398,9 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    /* TBs left in the current sampling phase, see qemu_plugin_sample_off */
+    int32_t plugin_sample_left;
+    bool plugin_sample_off;
 #endif
 
     /* TODO Move common fields from CPUArchState here. */
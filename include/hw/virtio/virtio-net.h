@@ -22,6 +22,7 @@
 #include "qom/object.h"
 
 #include "ebpf/ebpf_rss.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -50,6 +51,8 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    uint32_t num_iothreads;
+    char **iothread_ids;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -155,6 +158,8 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* Context that processes the queue pair and its backend */
+    AioContext *ctx;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -219,6 +224,10 @@ struct VirtIONet {
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    /* Queue pair i is processed by iothreads[i % net_conf.num_iothreads] */
+    IOThread **iothreads;
+    bool dataplane_started;
+    bool saved_use_guest_notifier_mask;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
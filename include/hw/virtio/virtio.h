@@ -61,6 +61,8 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+typedef struct VirtQueueElementPool VirtQueueElementPool;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -72,6 +74,10 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    VirtQueueElementPool *pool;
+    /* VIRTIO_F_IN_ORDER bookkeeping, only used in the used element ring */
+    bool in_order_filled;
+    bool in_order_full;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -146,6 +152,16 @@ struct VirtIODevice
     bool started;
     bool start_on_kick; /* when virtio 1.0 feature has not been negotiated */
     bool disable_legacy_check;
+    /*
+     * Interrupt coalescing for queues notified through virtio_notify()
+     * and virtio_notify_irqfd(): the longest delay in microseconds
+     * (0 disables coalescing), the number of notifications after which a
+     * pending interrupt is sent early, and whether the delay follows the
+     * notification rate of each queue.
+     */
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_frames;
+    bool irq_coalesce_adaptive;
     bool vhost_started;
     VMChangeStateEntry *vmstate;
     char *bus_name;
@@ -253,6 +269,8 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int num);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -264,6 +282,11 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max);
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                           unsigned int num);
+void virtqueue_element_free(VirtQueueElement *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -390,6 +413,9 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/* Default VirtioDeviceClass start_ioeventfd/stop_ioeventfd callbacks */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
@@ -69,6 +69,8 @@ typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
+typedef void (NetSetAioContext)(NetClientState *, AioContext *);
+typedef void (NetPrintInfo)(NetClientState *, Monitor *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -98,6 +100,15 @@ typedef struct NetClientInfo {
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
     NetCheckPeerType *check_peer_type;
+    /*
+     * Move the client's event handlers to @ctx, or back to the main loop
+     * if @ctx is NULL.  Called from the thread that runs the handlers at
+     * the time of the call.  The handlers hold the AioContext lock of a
+     * context other than the main loop while they run.
+     */
+    NetSetAioContext *set_aio_context;
+    /* Print backend specific runtime information for "info network". */
+    NetPrintInfo *print_info;
 } NetClientInfo;
 
 struct NetClientState {
@@ -118,6 +129,8 @@ struct NetClientState {
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
     bool is_datapath;
+    /* Packets may be handled in an IOThread; filters are not supported */
+    bool in_iothread;
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
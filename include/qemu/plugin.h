@@ -74,6 +74,8 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
+    PLUGIN_CB_TRACE,
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -92,11 +94,62 @@ struct qemu_plugin_dyn_cb {
     union {
         struct {
             enum qemu_plugin_op op;
+            /* if @entry.score is NULL, the op applies to @userp */
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
+        /* @userp is the struct qemu_plugin_mem_buf */
+        struct {
+            uint64_t pc;
+            /* accesses recorded by the insn, computed by plugin-gen */
+            unsigned int n;
+        } trace;
     };
 };
 
+/*
+ * A scoreboard holds one entry per vCPU index.  Generated code indexes
+ * @data->data directly, so it may only be reallocated while no vCPU
+ * runs, and all translations must be flushed afterwards.
+ */
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+/*
+ * What a memory trace buffer holds for each vCPU.  Generated code may
+ * append records up to @reserved in the current instruction.
+ */
+struct plugin_mem_buf_entry {
+    uint32_t used;
+    uint32_t reserved;
+    struct qemu_plugin_mem_record records[];
+};
+
+struct qemu_plugin_mem_buf {
+    qemu_plugin_vcpu_mem_buf_cb_t cb;
+    void *userdata;
+    uint32_t n_records;
+    /* one struct plugin_mem_buf_entry per vCPU */
+    struct qemu_plugin_scoreboard *score;
+    QLIST_ENTRY(qemu_plugin_mem_buf) entry;
+};
+
+static inline uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                           unsigned int vcpu_index)
+{
+    GArray *data = entry.score->data;
+    char *base = data->data + vcpu_index * g_array_get_element_size(data);
+
+    return (uint64_t *)(base + entry.offset);
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -210,6 +263,31 @@ static inline void qemu_plugin_disable_mem_helpers(CPUState *cpu)
     cpu->plugin_mem_cbs = NULL;
 }
 
+enum plugin_sample_mode {
+    PLUGIN_SAMPLE_NONE,
+    PLUGIN_SAMPLE_TBS,
+    PLUGIN_SAMPLE_TIME,
+};
+
+/* Set once all plugins are loaded; see qemu_plugin_register_sampling(). */
+extern enum plugin_sample_mode plugin_sampling;
+
+bool qemu_plugin_sample_off__slow(CPUState *cpu);
+
+/**
+ * qemu_plugin_sample_off(): is instrumentation sampled out for @cpu?
+ * @cpu: the executing vCPU
+ *
+ * Called when choosing the cflags of the next TB.  While this returns
+ * true, @cpu runs a variant of the code translated with CF_PLUGIN_OFF,
+ * which carries no instrumentation.
+ */
+static inline bool qemu_plugin_sample_off(CPUState *cpu)
+{
+    return unlikely(plugin_sampling != PLUGIN_SAMPLE_NONE) &&
+           qemu_plugin_sample_off__slow(cpu);
+}
+
 /**
  * qemu_plugin_user_exit(): clean-up callbacks before calling exit callbacks
  *
@@ -257,6 +335,11 @@ static inline int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
 static inline void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 { }
 
+static inline bool qemu_plugin_sample_off(CPUState *cpu)
+{
+    return false;
+}
+
 static inline void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 { }
 
@@ -51,7 +51,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -210,6 +210,23 @@ void qemu_plugin_register_vcpu_resume_cb(qemu_plugin_id_t id,
 struct qemu_plugin_tb;
 /** struct qemu_plugin_insn - Opaque handle for a translated instruction */
 struct qemu_plugin_insn;
+/** struct qemu_plugin_scoreboard - Opaque handle for a per-vCPU array */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of a scoreboard entry
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t within each entry
+ *
+ * Names one uint64_t in every vCPU's entry of @score. Inline
+ * operations and conditional callbacks on a qemu_plugin_u64 act on the
+ * entry of the vCPU executing the instrumented code, so no two vCPUs
+ * ever touch the same counter.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
 
 /**
  * enum qemu_plugin_cb_flags - type of callback
@@ -274,12 +291,40 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
  *
- * Note: currently only a single inline op is supported.
+ * Any number of inline ops may be registered for the same event; they
+ * are executed in the order they were registered.
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
+};
+
+/**
+ * enum qemu_plugin_cond - condition for a conditional callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: false
+ * @QEMU_PLUGIN_COND_ALWAYS: true
+ * @QEMU_PLUGIN_COND_EQ: is equal?
+ * @QEMU_PLUGIN_COND_NE: is not equal?
+ * @QEMU_PLUGIN_COND_LT: is less than?
+ * @QEMU_PLUGIN_COND_LE: is less than or equal?
+ * @QEMU_PLUGIN_COND_GT: is greater than?
+ * @QEMU_PLUGIN_COND_GE: is greater than or equal?
+ *
+ * All comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
 };
 
 /**
@@ -300,6 +345,47 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry the op applies to
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on the executing vCPU's @entry every time a
+ * translated unit executes. Unlike qemu_plugin_register_vcpu_tb_exec_inline()
+ * this is exact with any number of vCPUs.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - conditional execution cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to test
+ * @entry: value compared by @cond
+ * @imm: value @entry is compared with
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time a translated unit executes
+ * and "@entry @cond @imm" holds for the executing vCPU. The test is
+ * done inline, after any inline ops registered for the same block, so
+ * a counter can trigger a callback when it reaches a threshold without
+ * a call on every execution.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -328,6 +414,44 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry the op applies to
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on the executing vCPU's @entry every time an
+ * instruction executes.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition to test
+ * @entry: value compared by @cond
+ * @imm: value @entry is compared with
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time an instruction executes and
+ * "@entry @cond @imm" holds for the executing vCPU.
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -536,6 +660,99 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU inline op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the op, of type qemu_plugin_op
+ * @entry: entry the op applies to
+ * @imm: immediate data for @op
+ *
+ * This registers an inline op on the executing vCPU's @entry for every
+ * memory access generated by the instruction.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * struct qemu_plugin_mem_record - a memory access recorded by QEMU
+ * @vaddr: the virtual address of the access
+ * @pc: the virtual address of the instruction that performed it
+ * @info: the access, to be queried with qemu_plugin_mem_is_store() etc.
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    uint64_t pc;
+    qemu_plugin_meminfo_t info;
+    uint32_t reserved;
+};
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buf_cb_t - memory trace buffer callback
+ * @vcpu_index: the vCPU whose accesses are reported
+ * @records: the accesses, in program order
+ * @n: number of entries in @records
+ * @userdata: the @userdata given to qemu_plugin_mem_buf_new()
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_vcpu_mem_buf_cb_t)(
+    unsigned int vcpu_index,
+    const struct qemu_plugin_mem_record *records,
+    size_t n,
+    void *userdata);
+
+/** struct qemu_plugin_mem_buf - opaque per-vCPU memory trace buffer */
+struct qemu_plugin_mem_buf;
+
+/**
+ * qemu_plugin_mem_buf_new() - allocate a memory trace buffer
+ * @cb: callback that consumes the records
+ * @n_records: capacity of the buffer of each vCPU
+ * @userdata: any plugin data to pass to @cb
+ *
+ * Accesses traced with qemu_plugin_register_vcpu_mem_trace() are
+ * appended to a buffer of the executing vCPU by the generated code,
+ * without any call. @cb is only called when a buffer is about to
+ * overflow, on qemu_plugin_mem_buf_flush(), when the vCPU exits, and
+ * before the atexit callbacks run. @n_records is rounded up to at
+ * least 1024.
+ *
+ * Returns: the new buffer. It lives until QEMU exits.
+ */
+struct qemu_plugin_mem_buf *
+qemu_plugin_mem_buf_new(qemu_plugin_vcpu_mem_buf_cb_t cb, size_t n_records,
+                        void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_trace() - record accesses into a buffer
+ * @insn: handle for instruction to instrument
+ * @rw: which accesses to record (read, write or both)
+ * @buf: buffer to record them to
+ *
+ * This is a cheaper alternative to qemu_plugin_register_vcpu_mem_cb()
+ * for plugins that collect traces and can process them in batches.
+ */
+void qemu_plugin_register_vcpu_mem_trace(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_buf *buf);
+
+/**
+ * qemu_plugin_mem_buf_flush() - hand over the records of a vCPU now
+ * @buf: the buffer to flush
+ * @vcpu_index: the vCPU whose records to flush
+ *
+ * Call the buffer callback for any records pending for @vcpu_index.
+ * This must be called from a callback running on that vCPU, e.g. to
+ * keep the trace in sync with syscalls, or from an atexit callback.
+ */
+void qemu_plugin_mem_buf_flush(struct qemu_plugin_mem_buf *buf,
+                               unsigned int vcpu_index);
+
 
 
 typedef void
@@ -611,6 +828,50 @@ int qemu_plugin_n_vcpus(void);
 /* returns -1 in user-mode */
 int qemu_plugin_n_max_vcpus(void);
 
+/**
+ * qemu_plugin_num_vcpus() - number of vCPU indices in use
+ *
+ * Returns one more than the highest vCPU index initialized so far, in
+ * both system and user mode. This is the range to iterate over when
+ * reading a scoreboard.
+ */
+int qemu_plugin_num_vcpus(void);
+
+/**
+ * enum qemu_plugin_sample_mode - unit of sampling periods
+ *
+ * @QEMU_PLUGIN_SAMPLE_TBS: executed translation blocks, counted per vCPU
+ * @QEMU_PLUGIN_SAMPLE_TIME: nanoseconds of host time, for all vCPUs at once;
+ *   each vCPU checks the time every few hundred translation blocks
+ */
+enum qemu_plugin_sample_mode {
+    QEMU_PLUGIN_SAMPLE_TBS,
+    QEMU_PLUGIN_SAMPLE_TIME,
+};
+
+/**
+ * qemu_plugin_register_sampling() - only instrument part of the execution
+ * @id: plugin ID
+ * @mode: unit of @period and @window
+ * @period: length of a sampling period
+ * @window: how much of each period runs instrumented code
+ *
+ * Instead of instrumenting all of the execution, run instrumented code
+ * for @window out of every @period and plain code in between. No
+ * translation or execution callbacks, inline ops or memory callbacks
+ * happen outside of the window; other events are not affected. The
+ * result is a statistical profile at a fraction of the cost.
+ *
+ * Sampling applies to the instrumentation of all plugins, so it is only
+ * enabled if every loaded plugin asks for it with the same parameters.
+ * It can only be requested from qemu_plugin_install().
+ *
+ * Returns: 0 on success, -1 if the request cannot be honoured.
+ */
+int qemu_plugin_register_sampling(qemu_plugin_id_t id,
+                                  enum qemu_plugin_sample_mode mode,
+                                  uint64_t period, uint64_t window);
+
 /**
  * qemu_plugin_outs() - output string via QEMU's logging system
  * @string: a string
@@ -664,4 +925,71 @@ uint64_t qemu_plugin_end_code(void);
  */
 uint64_t qemu_plugin_entry_code(void);
 
+/**
+ * qemu_plugin_scoreboard_new() - alloc a new scoreboard
+ * @element_size: size (in bytes) of each vCPU's entry
+ *
+ * Returns a zero-initialized array with one entry per vCPU. QEMU grows
+ * it as vCPUs are created, so entries must only be accessed through
+ * qemu_plugin_scoreboard_find() or the qemu_plugin_u64 helpers, and
+ * pointers to them must not be kept across vCPU creation.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * The scoreboard must no longer be referenced by any instrumentation,
+ * which in practice means it can only be freed at exit.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get pointer to an entry of a scoreboard
+ * @score: scoreboard to query
+ * @vcpu_index: entry index
+ *
+ * Returns the address of the entry for vCPU @vcpu_index.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Macros to define a qemu_plugin_u64 */
+#define qemu_plugin_scoreboard_u64(score) \
+    (qemu_plugin_u64) {score, 0}
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    (qemu_plugin_u64) {score, offsetof(type, member)}
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set value of a qemu_plugin_u64 for a given vcpu
+ * @entry: entry to query
+ * @vcpu_index: entry index
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - return sum of all vcpu entries in a scoreboard
+ * @entry: entry to sum
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 #endif /* QEMU_QEMU_PLUGIN_H */
@@ -46,6 +46,8 @@ typedef struct KVMMemoryListener {
 } KVMMemoryListener;
 
 #define KVM_MSI_HASHTAB_SIZE    256
+#define KVM_DIRTY_RING_REAPERS_MAX  64
+#define KVM_DIRTY_SYNC_THREADS_MAX  64
 
 enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_NONE = 0,
@@ -64,6 +66,9 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Number of threads sharing the vCPU rings when reaping all of them */
+    uint32_t nr_reapers;
+    struct KVMWorkerPool *pool;
 };
 struct KVMState
 {
@@ -118,6 +123,9 @@ struct KVMState
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
+    /* Threads merging large slot bitmaps into the RAM dirty bitmaps */
+    uint32_t dirty_sync_threads;
+    struct KVMWorkerPool *dirty_sync_pool;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
     uint32_t xen_version;
@@ -286,9 +286,9 @@ void tcg_gen_goto_tb(unsigned idx);
 void tcg_gen_lookup_and_goto_ptr(void);
 
 static inline void tcg_gen_plugin_cb_start(unsigned from, unsigned type,
-                                           unsigned wr)
+                                           unsigned info, TCGArg addr)
 {
-    tcg_gen_op3(INDEX_op_plugin_cb_start, from, type, wr);
+    tcg_gen_op4(INDEX_op_plugin_cb_start, from, type, info, addr);
 }
 
 static inline void tcg_gen_plugin_cb_end(void)
@@ -761,6 +761,20 @@ void tcg_gen_qemu_st_i64_chk(TCGv_i64, TCGTemp *, TCGArg, MemOp, TCGType);
 void tcg_gen_qemu_ld_i128_chk(TCGv_i128, TCGTemp *, TCGArg, MemOp, TCGType);
 void tcg_gen_qemu_st_i128_chk(TCGv_i128, TCGTemp *, TCGArg, MemOp, TCGType);
 
+/**
+ * tcg_set_direct_ram:
+ * @mmu_idx: mmu index
+ * @vbase: guest virtual address at which @mmu_idx maps physical address 0
+ * @phys_limit: end of the physical range that @mmu_idx maps linearly
+ *
+ * Let loads through @mmu_idx in the block being translated read the
+ * direct RAM window (-accel tcg,direct-ram=on) without a TLB lookup,
+ * provided that it lies below @phys_limit.  Only mmu indexes that do
+ * not fault, and are not subject to permission checks, for the whole
+ * range may be enabled.
+ */
+void tcg_set_direct_ram(int mmu_idx, uint64_t vbase, uint64_t phys_limit);
+
 /* Atomic ops */
 
 void tcg_gen_atomic_cmpxchg_i32_chk(TCGv_i32, TCGTemp *, TCGv_i32, TCGv_i32,
@@ -942,6 +956,11 @@ static inline void tcg_gen_addi_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t b)
     glue(tcg_gen_addi_,PTR)((NAT)r, (NAT)a, b);
 }
 
+static inline void tcg_gen_muli_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t b)
+{
+    glue(tcg_gen_muli_,PTR)((NAT)r, (NAT)a, b);
+}
+
 static inline void tcg_gen_mov_ptr(TCGv_ptr d, TCGv_ptr s)
 {
     glue(tcg_gen_mov_,PTR)((NAT)d, (NAT)s);
@@ -138,7 +138,8 @@ typedef uint64_t TCGRegSet;
 
 #if !defined(TCG_TARGET_HAS_v64) \
     && !defined(TCG_TARGET_HAS_v128) \
-    && !defined(TCG_TARGET_HAS_v256)
+    && !defined(TCG_TARGET_HAS_v256) \
+    && !defined(TCG_TARGET_HAS_v512)
 #define TCG_TARGET_MAYBE_vec            0
 #define TCG_TARGET_HAS_abs_vec          0
 #define TCG_TARGET_HAS_neg_vec          0
@@ -171,6 +172,9 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_HAS_v256
 #define TCG_TARGET_HAS_v256             0
 #endif
+#ifndef TCG_TARGET_HAS_v512
+#define TCG_TARGET_HAS_v512             0
+#endif
 
 typedef enum TCGOpcode {
 #define DEF(name, oargs, iargs, cargs, flags) INDEX_op_ ## name,
@@ -249,9 +253,10 @@ typedef enum TCGType {
     TCG_TYPE_V64,
     TCG_TYPE_V128,
     TCG_TYPE_V256,
+    TCG_TYPE_V512,
 
     /* Number of different types (integer not enum) */
-#define TCG_TYPE_COUNT  (TCG_TYPE_V256 + 1)
+#define TCG_TYPE_COUNT  (TCG_TYPE_V512 + 1)
 
     /* An alias for the size of the host register.  */
 #if TCG_TARGET_REG_BITS == 32
@@ -430,6 +435,13 @@ typedef struct TCGTemp {
 
 typedef struct TCGContext TCGContext;
 
+/* A contiguous range of guest physical RAM and its host mapping. */
+typedef struct TCGDirectRAM {
+    uint64_t base;
+    uint64_t size;
+    uintptr_t host;
+} TCGDirectRAM;
+
 typedef struct TCGTempSet {
     unsigned long l[BITS_TO_LONGS(TCG_MAX_TEMPS)];
 } TCGTempSet;
@@ -527,6 +539,24 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+    /*
+     * Set for the contexts of background pretranslation threads, which
+     * must not consult the vCPU's TLB while generating code.
+     */
+    bool pretranslate;
+
+    /* Same-page direct branch targets noted by translator_use_goto_tb. */
+    int nb_goto_tb_dest;
+    uint64_t goto_tb_dest[2];
+
+    /*
+     * RAM that loads may read through its host mapping, for the mmu
+     * indexes enabled by the frontend with tcg_set_direct_ram.
+     */
+    TCGDirectRAM direct_ram;
+    uint32_t direct_ram_idxmap;
+    uint64_t direct_ram_vbase[16];
+
     /* These structures are private to tcg-target.c.inc.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(, TCGLabelQemuLdst) ldst_labels;
@@ -558,6 +588,9 @@ struct TCGContext {
     QTAILQ_HEAD(, TCGOp) ops, free_ops;
     QSIMPLEQ_HEAD(, TCGLabel) labels;
 
+    /* If set, ops are emitted before this one instead of at the end. */
+    TCGOp *emit_before_op;
+
     /* Tells which temporary holds a given register.
        It does not take into account fixed registers */
     TCGTemp *reg_to_temp[TCG_TARGET_NB_REGS];
@@ -730,6 +763,9 @@ static inline void tcg_set_insn_start_param(TCGOp *op, int arg, uint64_t v)
 /* The last op that was emitted.  */
 static inline TCGOp *tcg_last_op(void)
 {
+    if (tcg_ctx->emit_before_op) {
+        return QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    }
     return QTAILQ_LAST(&tcg_ctx->ops);
 }
 
@@ -754,6 +790,12 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+void tcg_region_enable_eviction(void);
+bool tcg_region_evict_wanted(void);
+ssize_t tcg_region_evict_begin(unsigned *pepoch);
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_evict_end(size_t idx, unsigned epoch);
+void tcg_region_touch(const void *tc_ptr);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -0,0 +1,29 @@
+/*
+ * System calls handled without leaving generated code
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef USER_SYSCALL_FAST_H
+#define USER_SYSCALL_FAST_H
+
+#include "exec/user/abitypes.h"
+
+/**
+ * do_syscall_fast: try to handle a system call from a TCG helper
+ * @cpu_env: the CPU making the call
+ * @num: target system call number
+ * @arg1: first argument
+ * @arg2: second argument
+ * @ret: set to the result, including negative target errnos
+ *
+ * Handles the system calls that only read the clock or the identity of
+ * the process, so that the system call instruction can complete within
+ * the current TB rather than exiting to the cpu loop.  Returns false if
+ * the call must go through the cpu loop and do_syscall() as usual, for
+ * example because it is traced by -strace or a plugin.
+ */
+bool do_syscall_fast(CPUArchState *cpu_env, int num, abi_long arg1,
+                     abi_long arg2, abi_long *ret);
+
+#endif /* USER_SYSCALL_FAST_H */
@@ -416,6 +416,11 @@ static void handle_arg_strace(const char *arg)
     enable_strace = true;
 }
 
+static void handle_arg_io_uring(const char *arg)
+{
+    io_uring_passthrough = true;
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -504,6 +509,8 @@ static const struct qemu_argument arg_table[] = {
      "",           "deprecated synonym for -one-insn-per-tb"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"io-uring",   "QEMU_IO_URING",    false, handle_arg_io_uring,
+     "",           "pass guest io_uring instances through to the host"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
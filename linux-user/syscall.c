@@ -121,6 +121,9 @@
 #ifdef HAVE_BTRFS_H
 #include <linux/btrfs.h>
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
 #ifdef HAVE_DRM_H
 #include <libdrm/drm.h>
 #include <libdrm/i915_drm.h>
@@ -138,6 +141,7 @@
 #include "qemu/guest-random.h"
 #include "qemu/selfmap.h"
 #include "user/syscall-trace.h"
+#include "user/syscall-fast.h"
 #include "special-errno.h"
 #include "qapi/error.h"
 #include "fd-trans.h"
@@ -752,6 +756,12 @@ safe_syscall6(ssize_t, copy_file_range, int, infd, loff_t *, pinoff,
               int, outfd, loff_t *, poutoff, size_t, length,
               unsigned int, flags)
 #endif
+#if defined(TARGET_NR_io_uring_enter) && defined(__NR_io_uring_enter) && \
+    defined(HAVE_LINUX_IO_URING_H)
+safe_syscall6(int, io_uring_enter, unsigned int, fd, unsigned int, to_submit,
+              unsigned int, min_complete, unsigned int, flags,
+              const void *, argp, size_t, argsz)
+#endif
 
 /* We do ioctl like this rather than via safe_syscall3 to preserve the
  * "third argument might be integer or pointer or not present" behaviour of
@@ -5614,6 +5624,18 @@ static abi_long do_ioctl(int fd, int cmd, abi_long arg)
     case TYPE_PTR:
         arg_type++;
         target_size = thunk_type_size(arg_type, 0);
+        if (thunk_type_identical(arg_type)) {
+            /* Let the host kernel access guest memory directly. */
+            argptr = lock_user(ie->access == IOC_W ? VERIFY_READ : VERIFY_WRITE,
+                               arg, target_size, ie->access != IOC_R);
+            if (!argptr) {
+                return -TARGET_EFAULT;
+            }
+            ret = get_errno(safe_ioctl(fd, ie->host_cmd, argptr));
+            unlock_user(argptr, arg, ie->access == IOC_W || is_error(ret) ?
+                                     0 : target_size);
+            break;
+        }
         switch(ie->access) {
         case IOC_R:
             ret = get_errno(safe_ioctl(fd, ie->host_cmd, buf_temp));
@@ -5884,6 +5906,316 @@ static const bitmask_transtbl mmap_flags_tbl[] = {
 #define TARGET_MAP_HUGE_1GB 0
 #endif
 
+bool io_uring_passthrough;
+
+#if defined(TARGET_NR_io_uring_setup) && defined(__NR_io_uring_setup) && \
+    defined(HAVE_LINUX_IO_URING_H)
+#define CONFIG_IO_URING_PASSTHROUGH
+
+/*
+ * Guest io_uring instances are host io_uring instances.  The rings are
+ * mapped into the guest as they are and the host kernel consumes the
+ * submission queue directly, so nothing in an SQE or CQE is translated.
+ * That is only sound if guest pointers are host pointers and the guest
+ * ABI is the host ABI for everything the kernel reads or writes through
+ * the ring; anything else gets -ENOSYS from io_uring_setup, as before.
+ */
+static bool io_uring_errnos_match(void)
+{
+#define E(X)  if (X != TARGET_##X) { return false; }
+#include "errnos.c.inc"
+#undef E
+    return true;
+}
+
+static bool io_uring_open_flags_match(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(fcntl_flags_tbl); i++) {
+        const bitmask_transtbl *t = &fcntl_flags_tbl[i];
+
+        if (t->target_mask != t->host_mask ||
+            t->target_bits != t->host_bits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool io_uring_supported(void)
+{
+    static int supported = -1;
+
+    if (supported < 0) {
+        supported = io_uring_passthrough &&
+                    TARGET_BIG_ENDIAN == HOST_BIG_ENDIAN &&
+                    TARGET_ABI_BITS == HOST_LONG_BITS &&
+                    guest_base == 0 && reserved_va == 0 &&
+                    TARGET_PAGE_SIZE == qemu_real_host_page_size() &&
+                    io_uring_errnos_match();
+    }
+    return supported;
+}
+
+/*
+ * SQE opcodes whose arguments still differ between guest and host are
+ * not executed by the host ring; they complete with -EACCES instead.
+ */
+static bool io_uring_sqe_op_allowed(int op)
+{
+    switch (op) {
+    case IORING_OP_EPOLL_CTL:
+        /* struct epoll_event padding. */
+#if defined(TARGET_EPOLL_PACKED) != defined(__x86_64__)
+        return false;
+#else
+        return true;
+#endif
+    case IORING_OP_OPENAT:
+    case IORING_OP_OPENAT2:
+    case IORING_OP_ACCEPT:
+    case IORING_OP_SOCKET:
+        return io_uring_open_flags_match();
+    case IORING_OP_URING_CMD:
+        /* Driver-specific, like ioctl. */
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Does any SQE opcode need to be excluded from the host rings? */
+static bool io_uring_restricted(void)
+{
+    int op;
+
+    for (op = 0; op < IORING_OP_LAST; op++) {
+        if (!io_uring_sqe_op_allowed(op)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Register the restriction set on the new, still disabled ring @fd.
+ *
+ * Restrictions are allow lists, and the kernel refuses the whole set if
+ * it names an opcode that the kernel does not know, which happens when
+ * it is older than the headers QEMU was built with.  SQE opcodes are
+ * therefore taken from the kernel's probe.  There is no probe for
+ * register opcodes; how many of them the kernel knows is found out by
+ * retrying with fewer, once per process.
+ */
+static int io_uring_register_restrictions(int fd)
+{
+    static int nr_register_ops = IORING_REGISTER_LAST;
+    g_autofree struct io_uring_probe *probe = NULL;
+    g_autofree struct io_uring_restriction *res = NULL;
+    unsigned n, nr_sqe = 0;
+    int op, ret;
+
+    probe = g_malloc0(sizeof(*probe) +
+                      IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                probe, IORING_OP_LAST) < 0) {
+        return -errno;
+    }
+
+    res = g_new0(struct io_uring_restriction,
+                 probe->ops_len + IORING_REGISTER_LAST + 1);
+    for (op = 0; op < probe->ops_len; op++) {
+        if (!(probe->ops[op].flags & IO_URING_OP_SUPPORTED) ||
+            !io_uring_sqe_op_allowed(op)) {
+            continue;
+        }
+        res[nr_sqe].opcode = IORING_RESTRICTION_SQE_OP;
+        res[nr_sqe].sqe_op = op;
+        nr_sqe++;
+    }
+    res[nr_sqe].opcode = IORING_RESTRICTION_SQE_FLAGS_ALLOWED;
+    res[nr_sqe].sqe_flags = 0xff;
+    nr_sqe++;
+
+    /* Once restricted, register opcodes need allowing too. */
+    while (true) {
+        int nr_ops = qatomic_read(&nr_register_ops);
+
+        n = nr_sqe;
+        for (op = 0; op < nr_ops; op++) {
+            res[n].opcode = IORING_RESTRICTION_REGISTER_OP;
+            res[n].register_op = op;
+            n++;
+        }
+        ret = syscall(__NR_io_uring_register, fd,
+                      IORING_REGISTER_RESTRICTIONS, res, n);
+        if (ret == 0) {
+            return 0;
+        }
+        if (errno != EINVAL || nr_ops == 0) {
+            return -errno;
+        }
+        qatomic_set(&nr_register_ops, nr_ops - 1);
+    }
+}
+
+/* Set once the guest has an io_uring instance; see do_mmap. */
+static bool io_uring_used;
+
+static abi_long do_io_uring_setup(abi_ulong entries, abi_ulong target_params)
+{
+    struct io_uring_params params;
+    bool restricted, guest_disabled;
+    int fd, ret;
+
+    if (!io_uring_supported()) {
+        return -TARGET_ENOSYS;
+    }
+    if (copy_from_user(&params, target_params, sizeof(params))) {
+        return -TARGET_EFAULT;
+    }
+
+    /*
+     * Restrictions can only be registered while the ring is disabled.
+     * A guest that asks for a disabled ring enables it itself; it can
+     * not register restrictions of its own on top of ours, though.
+     */
+    restricted = io_uring_restricted();
+    guest_disabled = params.flags & IORING_SETUP_R_DISABLED;
+    if (restricted) {
+        params.flags |= IORING_SETUP_R_DISABLED;
+    }
+
+    fd = syscall(__NR_io_uring_setup, (unsigned)entries, &params);
+    if (fd < 0) {
+        return get_errno(fd);
+    }
+
+    if (restricted) {
+        ret = io_uring_register_restrictions(fd);
+        if (ret == 0 && !guest_disabled &&
+            syscall(__NR_io_uring_register, fd, IORING_REGISTER_ENABLE_RINGS,
+                    NULL, 0) < 0) {
+            ret = -errno;
+        }
+        if (ret < 0) {
+            close(fd);
+            return -host_to_target_errno(-ret);
+        }
+        if (!guest_disabled) {
+            params.flags &= ~IORING_SETUP_R_DISABLED;
+        }
+    }
+
+    if (copy_to_user(target_params, &params, sizeof(params))) {
+        close(fd);
+        return -TARGET_EFAULT;
+    }
+    fd_trans_unregister(fd);
+    io_uring_used = true;
+    return fd;
+}
+
+static abi_long do_io_uring_enter(abi_long fd, abi_long to_submit,
+                                  abi_long min_complete, abi_long flags,
+                                  abi_ulong argp, abi_ulong argsz)
+{
+    sigset_t *set = NULL;
+    abi_long ret;
+
+    /*
+     * Only the signal mask needs translating; everything else the kernel
+     * reads from the rings or from @argp is already in host format.
+     */
+    if (flags & IORING_ENTER_EXT_ARG) {
+        struct io_uring_getevents_arg arg;
+
+        if (argsz != sizeof(arg)) {
+            return -TARGET_EINVAL;
+        }
+        if (copy_from_user(&arg, argp, sizeof(arg))) {
+            return -TARGET_EFAULT;
+        }
+        if (arg.sigmask) {
+            ret = process_sigsuspend_mask(&set, arg.sigmask, arg.sigmask_sz);
+            if (ret != 0) {
+                return ret;
+            }
+            arg.sigmask = (uintptr_t)set;
+            arg.sigmask_sz = SIGSET_T_SIZE;
+        }
+        ret = get_errno(safe_io_uring_enter(fd, to_submit, min_complete,
+                                            flags, &arg, sizeof(arg)));
+    } else {
+        if (argp) {
+            ret = process_sigsuspend_mask(&set, argp, argsz);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        ret = get_errno(safe_io_uring_enter(fd, to_submit, min_complete,
+                                            flags, set, SIGSET_T_SIZE));
+    }
+
+    if (set) {
+        finish_sigsuspend_mask(ret);
+    }
+    return ret;
+}
+
+static bool is_io_uring_fd(int fd)
+{
+    char path[32], link[32];
+    ssize_t len;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0) {
+        return false;
+    }
+    link[len] = '\0';
+    return strcmp(link, "anon_inode:[io_uring]") == 0;
+}
+
+/*
+ * The kernel chooses where io_uring rings go and refuses MAP_FIXED for
+ * them, so they cannot go through target_mmap.  With guest_base == 0
+ * the host address is the guest address; all that is left to do is
+ * checking that the guest can reach it and recording the mapping.
+ */
+static abi_long do_io_uring_mmap(abi_ulong len, int prot, int flags,
+                                  int fd, off_t offset)
+{
+    abi_ulong start, last;
+    void *p;
+
+    if (flags & MAP_FIXED) {
+        return -TARGET_EINVAL;
+    }
+
+    mmap_lock();
+    p = mmap(NULL, len, prot, flags, fd, offset);
+    if (p == MAP_FAILED) {
+        mmap_unlock();
+        return get_errno(-1);
+    }
+    if (!h2g_valid(p) || !h2g_valid((char *)p + len - 1)) {
+        munmap(p, len);
+        mmap_unlock();
+        return -TARGET_ENOMEM;
+    }
+
+    start = h2g(p);
+    last = start + TARGET_PAGE_ALIGN(len) - 1;
+    page_set_flags(start, last,
+                   PAGE_VALID | (prot & PROT_READ ? PAGE_READ : 0) |
+                   (prot & PROT_WRITE ? PAGE_WRITE : 0));
+    mmap_unlock();
+    return start;
+}
+#endif /* CONFIG_IO_URING_PASSTHROUGH */
+
 static abi_long do_mmap(abi_ulong addr, abi_ulong len, int prot,
                         int target_flags, int fd, off_t offset)
 {
@@ -5936,6 +6268,16 @@ static abi_long do_mmap(abi_ulong addr, abi_ulong len, int prot,
     }
     host_flags |= target_to_host_bitmask(target_flags, mmap_flags_tbl);
 
+#ifdef CONFIG_IO_URING_PASSTHROUGH
+    /* Only look at the file if the guest may have an io_uring instance */
+    if (io_uring_used &&
+        (offset == IORING_OFF_SQ_RING || offset == IORING_OFF_CQ_RING ||
+         offset == IORING_OFF_SQES) &&
+        !(host_flags & MAP_ANONYMOUS) && is_io_uring_fd(fd)) {
+        return do_io_uring_mmap(len, prot, host_flags, fd, offset);
+    }
+#endif
+
     return get_errno(target_mmap(addr, len, prot, host_flags, fd, offset));
 }
 
@@ -11631,8 +11973,17 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                 /*
                  * It is assumed that struct statx is architecture independent.
                  */
-                struct target_statx host_stx;
                 int mask = arg4;
+#if HOST_BIG_ENDIAN == TARGET_BIG_ENDIAN
+                /* Nothing to swap, so the host can fill in the guest's. */
+                if (!lock_user_struct(VERIFY_WRITE, target_stx, arg5, 0)) {
+                    unlock_user(p, arg2, 0);
+                    return -TARGET_EFAULT;
+                }
+                ret = get_errno(sys_statx(dirfd, p, flags, mask, target_stx));
+                unlock_user_struct(target_stx, arg5, !is_error(ret));
+#else
+                struct target_statx host_stx;
 
                 ret = get_errno(sys_statx(dirfd, p, flags, mask, &host_stx));
                 if (!is_error(ret)) {
@@ -11641,6 +11992,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                         return -TARGET_EFAULT;
                     }
                 }
+#endif
 
                 if (ret != -TARGET_ENOSYS) {
                     unlock_user(p, arg2, 0);
@@ -13552,6 +13904,22 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
         return get_errno(membarrier(arg1, arg2));
 #endif
 
+#ifdef CONFIG_IO_URING_PASSTHROUGH
+    case TARGET_NR_io_uring_setup:
+        return do_io_uring_setup(arg1, arg2);
+    case TARGET_NR_io_uring_enter:
+        if (!io_uring_supported()) {
+            return -TARGET_ENOSYS;
+        }
+        return do_io_uring_enter(arg1, arg2, arg3, arg4, arg5, arg6);
+    case TARGET_NR_io_uring_register:
+        if (!io_uring_supported()) {
+            return -TARGET_ENOSYS;
+        }
+        return get_errno(syscall(__NR_io_uring_register, arg1, arg2,
+                                 g2h_untagged(arg3), arg4));
+#endif
+
 #if defined(TARGET_NR_copy_file_range) && defined(__NR_copy_file_range)
     case TARGET_NR_copy_file_range:
         {
@@ -13618,6 +13986,92 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     return ret;
 }
 
+bool do_syscall_fast(CPUArchState *cpu_env, int num, abi_long arg1,
+                     abi_long arg2, abi_long *ret)
+{
+    CPUState *cpu = env_cpu(cpu_env);
+
+    /* Anybody watching syscalls must see these ones too. */
+    if (unlikely(qemu_loglevel_mask(LOG_STRACE)) ||
+        test_bit(QEMU_PLUGIN_EV_VCPU_SYSCALL, cpu->plugin_mask) ||
+        test_bit(QEMU_PLUGIN_EV_VCPU_SYSCALL_RET, cpu->plugin_mask)) {
+        return false;
+    }
+
+    switch (num) {
+#ifdef TARGET_NR_getpid
+    case TARGET_NR_getpid:
+        *ret = get_errno(getpid());
+        return true;
+#endif
+    case TARGET_NR_gettid:
+        *ret = get_errno(sys_gettid());
+        return true;
+#ifdef TARGET_NR_getuid
+    case TARGET_NR_getuid:
+        *ret = get_errno(high2lowuid(getuid()));
+        return true;
+#endif
+#ifdef TARGET_NR_geteuid
+    case TARGET_NR_geteuid:
+        *ret = get_errno(high2lowuid(geteuid()));
+        return true;
+#endif
+#ifdef TARGET_NR_getgid
+    case TARGET_NR_getgid:
+        *ret = get_errno(high2lowgid(getgid()));
+        return true;
+#endif
+#ifdef TARGET_NR_getegid
+    case TARGET_NR_getegid:
+        *ret = get_errno(high2lowgid(getegid()));
+        return true;
+#endif
+#ifdef TARGET_NR_time
+    case TARGET_NR_time:
+        {
+            time_t host_time;
+
+            *ret = get_errno(time(&host_time));
+            if (!is_error(*ret) && arg1 && put_user_sal(host_time, arg1)) {
+                *ret = -TARGET_EFAULT;
+            }
+        }
+        return true;
+#endif
+#if defined(TARGET_NR_gettimeofday)
+    case TARGET_NR_gettimeofday:
+        {
+            struct timeval tv;
+
+            /* The timezone is obsolete; leave it to the slow path. */
+            if (arg2) {
+                return false;
+            }
+            *ret = get_errno(gettimeofday(&tv, NULL));
+            if (!is_error(*ret) && arg1 && copy_to_user_timeval(arg1, &tv)) {
+                *ret = -TARGET_EFAULT;
+            }
+        }
+        return true;
+#endif
+#ifdef TARGET_NR_clock_gettime
+    case TARGET_NR_clock_gettime:
+        {
+            struct timespec ts;
+
+            *ret = get_errno(clock_gettime(arg1, &ts));
+            if (!is_error(*ret)) {
+                *ret = host_to_target_timespec(arg2, &ts);
+            }
+        }
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
 abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
@@ -61,6 +61,42 @@ static const argtype *thunk_type_next_ptr(const argtype *type_ptr)
     return thunk_type_next(type_ptr);
 }
 
+/*
+ * Return true if converting @type_ptr in either direction is a plain
+ * copy, e.g. for an aarch64 guest on an aarch64 host.  Must only be
+ * used for structs that have been registered already.
+ */
+bool thunk_type_identical(const argtype *type_ptr)
+{
+#if HOST_BIG_ENDIAN != TARGET_BIG_ENDIAN
+    return false;
+#else
+    switch (*type_ptr) {
+    case TYPE_CHAR:
+    case TYPE_SHORT:
+    case TYPE_INT:
+    case TYPE_LONGLONG:
+    case TYPE_ULONGLONG:
+        return true;
+    case TYPE_LONG:
+    case TYPE_ULONG:
+    case TYPE_PTRVOID:
+        return HOST_LONG_BITS == TARGET_ABI_BITS;
+    case TYPE_OLDDEVT:
+        return thunk_type_size(type_ptr, THUNK_HOST) ==
+               thunk_type_size(type_ptr, THUNK_TARGET);
+    case TYPE_ARRAY:
+        return thunk_type_identical(type_ptr + 2);
+    case TYPE_STRUCT:
+        assert(type_ptr[1] < max_struct_entries);
+        return struct_entries[type_ptr[1]].identical;
+    default:
+        /* Pointers inside structs are never followed by thunk_convert. */
+        return false;
+    }
+#endif
+}
+
 void thunk_register_struct(int id, const char *name, const argtype *types)
 {
     const argtype *type_ptr;
@@ -87,6 +123,7 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
 #endif
     /* now we can alloc the data */
 
+    se->identical = true;
     for (i = 0; i < ARRAY_SIZE(se->field_offsets); i++) {
         offset = 0;
         max_align = 1;
@@ -97,6 +134,11 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
             align = thunk_type_align(type_ptr, i);
             offset = (offset + align - 1) & ~(align - 1);
             se->field_offsets[i][j] = offset;
+            if (i == THUNK_HOST &&
+                (offset != se->field_offsets[THUNK_TARGET][j] ||
+                 !thunk_type_identical(type_ptr))) {
+                se->identical = false;
+            }
             offset += size;
             if (align > max_align)
                 max_align = align;
@@ -110,6 +152,9 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
                i == THUNK_HOST ? "host" : "target", offset, max_align);
 #endif
     }
+    if (se->size[THUNK_HOST] != se->size[THUNK_TARGET]) {
+        se->identical = false;
+    }
 }
 
 void thunk_register_struct_direct(int id, const char *name,
@@ -121,6 +166,7 @@ void thunk_register_struct_direct(int id, const char *name,
     se = struct_entries + id;
     *se = *se1;
     se->name = name;
+    se->identical = false;
 }
 
 
@@ -247,7 +293,9 @@ const argtype *thunk_convert(void *dst, const void *src,
 
             assert(*type_ptr < max_struct_entries);
             se = struct_entries + *type_ptr++;
-            if (se->convert[0] != NULL) {
+            if (se->identical) {
+                memcpy(dst, src, se->size[to_host]);
+            } else if (se->convert[0] != NULL) {
                 /* specific conversion is needed */
                 (*se->convert[to_host])(dst, src);
             } else {
@@ -29,6 +29,7 @@ void task_settid(TaskState *);
 void stop_all_tasks(void);
 extern const char *qemu_uname_release;
 extern unsigned long mmap_min_addr;
+extern bool io_uring_passthrough;
 
 typedef struct IOCTLEntry IOCTLEntry;
 
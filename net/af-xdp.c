@@ -53,20 +53,107 @@ typedef struct AFXDPState {
     uint32_t             n_queues;
     uint32_t             xdp_flags;
     bool                 inhibit;
+
+    /* Context running the fd handlers, NULL for the main loop. */
+    AioContext           *ctx;
+
+    uint32_t             batch_size;
+    bool                 busy_poll;
+
+    /* Event counters, reported by "info network". */
+    struct {
+        uint64_t         tx_ring_full;
+        uint64_t         fq_starved;
+        uint64_t         rx_wakeups;
+        uint64_t         tx_wakeups;
+        uint64_t         busy_poll_hits;
+    } stats;
 } AFXDPState;
 
-#define AF_XDP_BATCH_SIZE 64
+#define AF_XDP_DEFAULT_BATCH_SIZE 64
+
+/* SO_BUSY_POLL timeout used when busy polling is enabled. */
+#define AF_XDP_BUSY_POLL_USECS 20
 
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
+/* Handlers used when running in an AioContext other than the main loop. */
+static void af_xdp_aio_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    af_xdp_send(s);
+    aio_context_release(ctx);
+}
+
+static void af_xdp_aio_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    af_xdp_writable(s);
+    aio_context_release(ctx);
+}
+
+/*
+ * Busy polling: check the rings from the AioContext polling loop instead
+ * of waiting for the socket to become readable.  Runs without the
+ * AioContext lock, but always in the thread that runs the handlers.
+ */
+static bool af_xdp_aio_poll(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    if (s->read_poll && xsk_cons_nb_avail(&s->rx, 1)) {
+        return true;
+    }
+    if (s->write_poll && xsk_cons_nb_avail(&s->cq, 1)) {
+        return true;
+    }
+    if (s->read_poll) {
+        /* Nothing yet, let the kernel run the device's NAPI context. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return false;
+}
+
+static void af_xdp_aio_poll_ready(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    s->stats.busy_poll_hits++;
+    if (s->read_poll) {
+        af_xdp_send(s);
+    }
+    if (s->write_poll) {
+        af_xdp_writable(s);
+    }
+    aio_context_release(ctx);
+}
+
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    if (s->ctx) {
+        bool busy_poll = s->busy_poll && (s->read_poll || s->write_poll);
+
+        aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk),
+                           s->read_poll ? af_xdp_aio_send : NULL,
+                           s->write_poll ? af_xdp_aio_writable : NULL,
+                           busy_poll ? af_xdp_aio_poll : NULL,
+                           busy_poll ? af_xdp_aio_poll_ready : NULL, s);
+    } else {
+        qemu_set_fd_handler(xsk_socket__fd(s->xsk),
+                            s->read_poll ? af_xdp_send : NULL,
+                            s->write_poll ? af_xdp_writable : NULL,
+                            s);
+    }
 }
 
 /* Update the read handler. */
@@ -98,6 +185,32 @@ static void af_xdp_poll(NetClientState *nc, bool enable)
     }
 }
 
+/* Move the event-loop handlers to another AioContext. */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    int fd = xsk_socket__fd(s->xsk);
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(fd, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+}
+
+/* The kernel asked for a kick to process the Tx ring. */
+static void af_xdp_tx_wakeup(AFXDPState *s)
+{
+    s->stats.tx_wakeups++;
+    if (s->busy_poll) {
+        /* Don't wait for the next poll, kick the Tx right away. */
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+    af_xdp_write_poll(s, true);
+}
+
 static void af_xdp_complete_tx(AFXDPState *s)
 {
     uint32_t idx = 0;
@@ -140,10 +253,11 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
@@ -161,6 +275,7 @@ static ssize_t af_xdp_receive(NetClientState *nc,
          * Out of buffers or space in tx ring.  Poll until we can write.
          * This will also kick the Tx, if it was waiting on CQ.
          */
+        s->stats.tx_ring_full++;
         af_xdp_write_poll(s, true);
         return 0;
     }
@@ -169,19 +284,31 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     desc->addr = s->pool[--s->n_pool];
     desc->len = size;
 
+    /* Gather the packet straight into the frame, no bounce buffer. */
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
 
     if (xsk_ring_prod__needs_wakeup(&s->tx)) {
-        af_xdp_write_poll(s, true);
+        af_xdp_tx_wakeup(s);
     }
 
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -199,6 +326,7 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
 
     /* Leave one packet for Tx, just in case. */
     if (s->n_pool < n + 1) {
+        s->stats.fq_starved++;
         n = s->n_pool;
     }
 
@@ -213,6 +341,11 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
 
     if (xsk_ring_prod__needs_wakeup(&s->fq)) {
         /* Receive was blocked by not having enough buffers.  Wake it up. */
+        s->stats.rx_wakeups++;
+        if (s->busy_poll) {
+            recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT,
+                     NULL, NULL);
+        }
         af_xdp_read_poll(s, true);
     }
 }
@@ -222,7 +355,7 @@ static void af_xdp_send(void *opaque)
     uint32_t i, n_rx, idx = 0;
     AFXDPState *s = opaque;
 
-    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    n_rx = xsk_ring_cons__peek(&s->rx, s->batch_size, &idx);
     if (!n_rx) {
         return;
     }
@@ -255,7 +388,7 @@ static void af_xdp_send(void *opaque)
 
     /* Release actually sent descriptors and try to re-fill. */
     xsk_ring_cons__release(&s->rx, n_rx);
-    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+    af_xdp_fq_refill(s, s->batch_size);
 }
 
 /* Flush and close. */
@@ -265,9 +398,16 @@ static void af_xdp_cleanup(NetClientState *nc)
 
     qemu_purge_queued_packets(nc);
 
+    if (s->ctx) {
+        /* Keep the handlers from running while the socket goes away. */
+        aio_context_acquire(s->ctx);
+    }
     af_xdp_poll(nc, false);
-
     xsk_socket__delete(s->xsk);
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
+
     s->xsk = NULL;
     g_free(s->pool);
     s->pool = NULL;
@@ -334,6 +474,30 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
     return 0;
 }
 
+static int af_xdp_set_busy_poll(AFXDPState *s, Error **errp)
+{
+#ifdef SO_PREFER_BUSY_POLL
+    int fd = xsk_socket__fd(s->xsk);
+    int prefer = 1, usecs = AF_XDP_BUSY_POLL_USECS, budget = s->batch_size;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                   &prefer, sizeof(prefer))
+        || setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs))
+        || setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+                      &budget, sizeof(budget))) {
+        error_setg_errno(errp, errno,
+                         "failed to enable busy polling for %s queue_index: %d",
+                         s->ifname, s->nc.queue_index);
+        return -1;
+    }
+
+    return 0;
+#else
+    error_setg(errp, "busy polling of AF_XDP sockets is not supported");
+    return -1;
+#endif
+}
+
 static int af_xdp_socket_create(AFXDPState *s,
                                 const NetdevAFXDPOptions *opts, Error **errp)
 {
@@ -394,16 +558,59 @@ static int af_xdp_socket_create(AFXDPState *s,
 
     s->xdp_flags = cfg.xdp_flags;
 
+    if (s->busy_poll && af_xdp_set_busy_poll(s, errp)) {
+        return -1;
+    }
+
     return 0;
 }
 
+static void af_xdp_print_info(NetClientState *nc, Monitor *mon)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct xdp_statistics xs = { 0 };
+    socklen_t len = sizeof(xs);
+
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
+
+    monitor_printf(mon, "  batch-size=%" PRIu32 ",busy-poll=%s"
+                   ",tx-ring-full=%" PRIu64 ",fill-starved=%" PRIu64
+                   ",rx-wakeups=%" PRIu64 ",tx-wakeups=%" PRIu64
+                   ",busy-poll-hits=%" PRIu64 "\n",
+                   s->batch_size, s->busy_poll ? "on" : "off",
+                   s->stats.tx_ring_full, s->stats.fq_starved,
+                   s->stats.rx_wakeups, s->stats.tx_wakeups,
+                   s->stats.busy_poll_hits);
+
+    if (s->xsk && !getsockopt(xsk_socket__fd(s->xsk), SOL_XDP,
+                              XDP_STATISTICS, &xs, &len)) {
+        monitor_printf(mon, "  kernel: rx-dropped=%" PRIu64
+                       ",rx-ring-full=%" PRIu64
+                       ",rx-fill-ring-empty=%" PRIu64
+                       ",tx-ring-empty=%" PRIu64 "\n",
+                       (uint64_t)xs.rx_dropped,
+                       (uint64_t)xs.rx_ring_full,
+                       (uint64_t)xs.rx_fill_ring_empty_descs,
+                       (uint64_t)xs.tx_ring_empty_descs);
+    }
+
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
+}
+
 /* NetClientInfo methods. */
 static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
+    .print_info = af_xdp_print_info,
 };
 
 static int *parse_socket_fds(const char *sock_fds_str,
@@ -448,7 +655,7 @@ int net_init_af_xdp(const Netdev *netdev,
     unsigned int ifindex;
     uint32_t prog_id = 0;
     int *sock_fds = NULL;
-    int64_t i, queues;
+    int64_t i, queues, batch_size;
     Error *err = NULL;
     AFXDPState *s;
 
@@ -466,6 +673,15 @@ int net_init_af_xdp(const Netdev *netdev,
         return -1;
     }
 
+    batch_size = opts->has_batch_size ? opts->batch_size
+                                      : AF_XDP_DEFAULT_BATCH_SIZE;
+    if (batch_size < 1 || batch_size > XSK_RING_CONS__DEFAULT_NUM_DESCS) {
+        error_setg(errp, "invalid batch size (%" PRIi64 ") for '%s', "
+                   "must be between 1 and %d", batch_size, opts->ifname,
+                   XSK_RING_CONS__DEFAULT_NUM_DESCS);
+        return -1;
+    }
+
     if ((opts->has_inhibit && opts->inhibit) != !!opts->sock_fds) {
         error_setg(errp, "'inhibit=on' requires 'sock-fds' and vice versa");
         return -1;
@@ -492,6 +708,8 @@ int net_init_af_xdp(const Netdev *netdev,
         pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
         s->ifindex = ifindex;
         s->n_queues = queues;
+        s->batch_size = batch_size;
+        s->busy_poll = opts->has_busy_poll && opts->busy_poll;
 
         if (af_xdp_umem_create(s, sock_fds ? sock_fds[i] : -1, errp)
             || af_xdp_socket_create(s, opts, errp)) {
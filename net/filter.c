@@ -245,6 +245,12 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    if (ncs[0]->in_iothread) {
+        error_setg(errp, "netdev '%s' is used with iothreads, which do not "
+                   "support filters", nf->netdev_id);
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
@@ -62,6 +62,8 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    /* Context running the fd handlers, NULL for the main loop */
+    AioContext *ctx;
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -70,12 +72,42 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static void tap_aio_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    tap_send(s);
+    aio_context_release(ctx);
+}
+
+static void tap_aio_writable(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    tap_writable(s);
+    aio_context_release(ctx);
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    bool read = s->read_poll && s->enabled;
+    bool write = s->write_poll && s->enabled;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd,
+                           read ? tap_aio_send : NULL,
+                           write ? tap_aio_writable : NULL,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd,
+                            read ? tap_send : NULL,
+                            write ? tap_writable : NULL,
+                            s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -356,10 +388,17 @@ static void tap_cleanup(NetClientState *nc)
     tap_exit_notify(&s->exit, NULL);
     qemu_remove_exit_notifier(&s->exit);
 
+    if (s->ctx) {
+        /* Keep the handlers from running while the fd goes away */
+        aio_context_acquire(s->ctx);
+    }
     tap_read_poll(s, false);
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
@@ -369,6 +408,19 @@ static void tap_poll(NetClientState *nc, bool enable)
     tap_write_poll(s, enable);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -406,6 +458,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
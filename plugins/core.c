@@ -20,6 +20,7 @@
 #include "qemu/rcu_queue.h"
 #include "qemu/xxhash.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "hw/core/cpu.h"
 #include "exec/cpu-common.h"
 
@@ -210,11 +211,64 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make sure every scoreboard has an entry for @cpu.  In system mode the
+ * scoreboards are sized for max_cpus up front (see qemu_plugin_load_list),
+ * so this only ever reallocates in user mode, where new vCPUs are created
+ * by a guest thread outside of cpu_exec.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+    bool flush = false;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin.scoreboard_alloc_size;
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+    if (size == plugin.scoreboard_alloc_size ||
+        QLIST_EMPTY(&plugin.scoreboards)) {
+        plugin.scoreboard_alloc_size = size;
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    /*
+     * Translated code points into the scoreboards: stop all vCPUs before
+     * moving them, and flush the code afterwards.  Same locking order as
+     * qemu_plugin_user_exit().
+     */
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, size);
+        }
+        plugin.scoreboard_alloc_size = size;
+        flush = true;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    if (flush) {
+        tb_flush(current_cpu);
+    }
+    end_exclusive();
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
+    /* the first TB looked up opens a sampling window */
+    cpu->plugin_sample_off = true;
+    cpu->plugin_sample_left = 0;
+
     qemu_rec_mutex_lock(&plugin.lock);
+    qatomic_set(&plugin.num_vcpus, MAX(plugin.num_vcpus, cpu->cpu_index + 1));
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -224,10 +278,22 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
 }
 
+static void plugin_mem_bufs_flush(unsigned int vcpu_index)
+{
+    struct qemu_plugin_mem_buf *buf;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(buf, &plugin.mem_bufs, entry) {
+        plugin_mem_buf_flush(buf, vcpu_index);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+}
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_bufs_flush(cpu->cpu_index);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -291,6 +357,25 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry.score = NULL;
+    dyn_cb->inline_insn.entry.offset = 0;
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -307,6 +392,38 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     dyn_cb->type = PLUGIN_CB_REGULAR;
 }
 
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.imm = imm;
+}
+
+void plugin_register_mem_trace(GArray **arr, uint64_t pc,
+                               enum qemu_plugin_mem_rw rw,
+                               struct qemu_plugin_mem_buf *buf)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = buf;
+    dyn_cb->type = PLUGIN_CB_TRACE;
+    dyn_cb->rw = rw;
+    dyn_cb->trace.pc = pc;
+    dyn_cb->trace.n = 0;
+}
+
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
                                  enum qemu_plugin_cb_flags flags,
@@ -432,19 +549,76 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
     uint64_t *val = cb->userp;
 
+    if (cb->inline_insn.entry.score) {
+        val = plugin_u64_address(cb->inline_insn.entry, cpu_index);
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+static struct plugin_mem_buf_entry *
+plugin_mem_buf_entry(struct qemu_plugin_mem_buf *buf, unsigned int vcpu_index)
+{
+    GArray *data = buf->score->data;
+
+    g_assert(vcpu_index < data->len);
+    return (struct plugin_mem_buf_entry *)
+        (data->data + vcpu_index * g_array_get_element_size(data));
+}
+
+void plugin_mem_buf_flush(struct qemu_plugin_mem_buf *buf,
+                          unsigned int vcpu_index)
+{
+    struct plugin_mem_buf_entry *e = plugin_mem_buf_entry(buf, vcpu_index);
+    uint32_t n = e->used;
+
+    if (n) {
+        /* keep the room reserved for the current instruction */
+        e->reserved = e->reserved > n ? e->reserved - n : 0;
+        /* the records stay put until this vCPU runs again */
+        e->used = 0;
+        buf->cb(vcpu_index, e->records, n, buf->userdata);
+    }
+}
+
+/* Slow path for accesses made from helpers, see gen_mem_trace(). */
+static void plugin_mem_trace_append(struct qemu_plugin_dyn_cb *cb,
+                                    unsigned int vcpu_index, uint64_t vaddr,
+                                    qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_buf *buf = cb->userp;
+    struct plugin_mem_buf_entry *e = plugin_mem_buf_entry(buf, vcpu_index);
+    struct qemu_plugin_mem_record *rec;
+    uint32_t left = e->reserved > e->used ? e->reserved - e->used : 0;
+
+    /*
+     * Generated code only reserves room for the accesses it makes
+     * itself, and may still use @left records of it in the current
+     * instruction; flush if this access does not fit besides them.
+     */
+    if (e->used + left >= buf->n_records) {
+        plugin_mem_buf_flush(buf, vcpu_index);
+    }
+    rec = &e->records[e->used++];
+    rec->vaddr = vaddr;
+    rec->pc = cb->trace.pc;
+    rec->info = info;
+    e->reserved = e->used + left;
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw)
 {
@@ -459,7 +633,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
             &g_array_index(arr, struct qemu_plugin_dyn_cb, i);
 
         if (!(rw & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
@@ -467,7 +641,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_TRACE:
+            plugin_mem_trace_append(cb, cpu->cpu_index, vaddr,
+                                    make_plugin_meminfo(oi, rw));
             break;
         default:
             g_assert_not_reached();
@@ -475,8 +653,169 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     }
 }
 
+int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_malloc0(sizeof(struct qemu_plugin_scoreboard));
+
+    score->data = g_array_new(false, true, element_size);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+struct qemu_plugin_mem_buf *
+plugin_mem_buf_new(qemu_plugin_vcpu_mem_buf_cb_t cb, size_t n_records,
+                   void *userdata)
+{
+    struct qemu_plugin_mem_buf *buf = g_new0(struct qemu_plugin_mem_buf, 1);
+
+    buf->cb = cb;
+    buf->userdata = userdata;
+    /* generated code indexes the records with a signed 32-bit offset */
+    buf->n_records = MIN(MAX(n_records, 1024), 1 << 24);
+    buf->score = plugin_scoreboard_new(
+        sizeof(struct plugin_mem_buf_entry) +
+        buf->n_records * sizeof(struct qemu_plugin_mem_record));
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_bufs, buf, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return buf;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
+/*
+ * Sampling
+ *
+ * Instrumentation is switched on and off by looking up TBs with or
+ * without CF_PLUGIN_OFF.  To change phase, a vCPU is made to leave its
+ * chain of TBs as if it had been kicked, by a countdown that
+ * plugin_gen_tb_start() plants in every TB.  In TB mode the countdown
+ * runs to the end of the phase; in time mode the vCPU checks the host
+ * clock every PLUGIN_SAMPLE_POLL_TBS TBs.  Either way, only the vCPU
+ * thread itself touches its sampling state.
+ */
+#define PLUGIN_SAMPLE_POLL_TBS 256
+
+enum plugin_sample_mode plugin_sampling;
+
+int plugin_register_sampling(qemu_plugin_id_t id,
+                             enum qemu_plugin_sample_mode mode,
+                             uint64_t period, uint64_t window)
+{
+    struct qemu_plugin_ctx *ctx;
+    int ret = -1;
+
+    if (window == 0 || window >= period) {
+        return -1;
+    }
+    if (mode == QEMU_PLUGIN_SAMPLE_TBS && period > INT32_MAX) {
+        return -1;
+    }
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    if (!ctx->installing) {
+        goto out;
+    }
+    if (plugin.sample.period &&
+        (plugin.sample.mode != mode || plugin.sample.period != period ||
+         plugin.sample.window != window)) {
+        goto out;
+    }
+    plugin.sample.mode = mode;
+    plugin.sample.period = period;
+    plugin.sample.window = window;
+    ctx->sampled = true;
+    ret = 0;
+ out:
+    qemu_rec_mutex_unlock(&plugin.lock);
+    return ret;
+}
+
+bool qemu_plugin_sample_off__slow(CPUState *cpu)
+{
+    bool off;
+
+    if (cpu->plugin_sample_left > 0) {
+        return cpu->plugin_sample_off;
+    }
+
+    if (plugin_sampling == PLUGIN_SAMPLE_TIME) {
+        uint64_t t = get_clock() - plugin.sample.start;
+
+        /* all vCPUs share the phase, as it only depends on the time */
+        cpu->plugin_sample_off = t % plugin.sample.period >=
+                                 plugin.sample.window;
+        cpu->plugin_sample_left = PLUGIN_SAMPLE_POLL_TBS;
+        return cpu->plugin_sample_off;
+    }
+
+    off = !cpu->plugin_sample_off;
+    cpu->plugin_sample_off = off;
+    cpu->plugin_sample_left = off ? plugin.sample.period - plugin.sample.window
+                                  : plugin.sample.window;
+    return off;
+}
+
+/* Called once all plugins are installed. */
+void plugin_sample_start(void)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    if (!plugin.sample.period) {
+        return;
+    }
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (!ctx->sampled) {
+            warn_report("not all plugins support sampling, "
+                        "instrumenting all of the execution");
+            return;
+        }
+    }
+
+    switch (plugin.sample.mode) {
+    case QEMU_PLUGIN_SAMPLE_TBS:
+        plugin_sampling = PLUGIN_SAMPLE_TBS;
+        break;
+    case QEMU_PLUGIN_SAMPLE_TIME:
+        plugin.sample.start = get_clock();
+        plugin_sampling = PLUGIN_SAMPLE_TIME;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 void qemu_plugin_atexit_cb(void)
 {
+    int i;
+
+    /* let plugins see all of the trace before they report */
+    for (i = 0; i < plugin_num_vcpus(); i++) {
+        plugin_mem_bufs_flush(i);
+    }
+
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -568,6 +907,9 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    QLIST_INIT(&plugin.mem_bufs);
+    plugin.scoreboard_alloc_size = 16;
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
@@ -300,6 +300,9 @@ int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
     info->system_emulation = true;
     info->system.smp_vcpus = ms->smp.cpus;
     info->system.max_vcpus = ms->smp.max_cpus;
+    /* Scoreboards never need to grow, see plugin_grow_scoreboards. */
+    plugin.scoreboard_alloc_size = MAX(plugin.scoreboard_alloc_size,
+                                       ms->smp.max_cpus);
 #else
     info->system_emulation = false;
 #endif
@@ -313,6 +316,7 @@ int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
         }
         QTAILQ_REMOVE(head, desc, entry);
     }
+    plugin_sample_start();
     return 0;
 }
 
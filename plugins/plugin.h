@@ -44,6 +44,21 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* all scoreboards, and the number of entries each of them has */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_alloc_size;
+    /* one more than the highest vCPU index seen */
+    int num_vcpus;
+    /* all memory trace buffers */
+    QLIST_HEAD(, qemu_plugin_mem_buf) mem_bufs;
+    /* sampling parameters, see qemu_plugin_register_sampling() */
+    struct {
+        enum qemu_plugin_sample_mode mode;
+        uint64_t period;
+        uint64_t window;
+        /* QEMU_PLUGIN_SAMPLE_TIME: host time the first period began */
+        int64_t start;
+    } sample;
 };
 
 
@@ -60,6 +75,8 @@ struct qemu_plugin_ctx {
     bool installing;
     bool uninstalling;
     bool resetting;
+    /* asked for sampled instrumentation */
+    bool sampled;
 };
 
 struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id);
@@ -69,6 +86,12 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -88,6 +111,15 @@ plugin_register_dyn_cb__udata(GArray **arr,
                               qemu_plugin_vcpu_udata_cb_t cb,
                               enum qemu_plugin_cb_flags flags, void *udata);
 
+void
+plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   enum qemu_plugin_cb_flags flags,
+                                   enum qemu_plugin_cond cond,
+                                   qemu_plugin_u64 entry,
+                                   uint64_t imm,
+                                   void *udata);
+
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
                                  void *cb,
@@ -95,6 +127,29 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index);
+
+int plugin_num_vcpus(void);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+int plugin_register_sampling(qemu_plugin_id_t id,
+                             enum qemu_plugin_sample_mode mode,
+                             uint64_t period, uint64_t window);
+
+void plugin_sample_start(void);
+
+struct qemu_plugin_mem_buf *
+plugin_mem_buf_new(qemu_plugin_vcpu_mem_buf_cb_t cb, size_t n_records,
+                   void *userdata);
+
+void plugin_register_mem_trace(GArray **arr, uint64_t pc,
+                               enum qemu_plugin_mem_rw rw,
+                               struct qemu_plugin_mem_buf *buf);
+
+void plugin_mem_buf_flush(struct qemu_plugin_mem_buf *buf,
+                          unsigned int vcpu_index);
 
 #endif /* PLUGIN_H */
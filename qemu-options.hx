@@ -183,9 +183,14 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                direct-ram=on|off (TCG loads from identity-mapped RAM bypass the TLB, default=off)\n"
+    "                pretranslate=n (TCG background translation threads, default 0)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                tb-evict=on|off (evict cold TCG code regions instead of flushing, default=off)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (threads collecting KVM dirty rings, default 1)\n"
+    "                dirty-sync-threads=n (threads merging KVM dirty bitmaps, default 1)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -218,12 +223,36 @@ SRST
         can be useful in some situations, such as when trying to analyse
         the logs produced by the ``-d`` option.
 
+    ``direct-ram=on|off``
+        Lets guest loads that the target maps linearly onto physical
+        memory (for example physical-mode or superpage accesses) read the
+        largest contiguous block of guest RAM directly, after an inline
+        bounds check instead of a softmmu TLB lookup. This mostly speeds
+        up firmware, early boot and guests using flat mappings. Stores are
+        not affected. The default is off.
+
+    ``pretranslate=n``
+        Starts n TCG threads that translate the likely successors of
+        freshly translated blocks (direct branch targets and fall-through
+        code on the same guest page) in the background, so that vCPUs
+        spend less time stalled in the translator during boot or JIT
+        warm-up. Requires ``thread=multi``. Statistics are shown by
+        ``info jit``. The default is 0 (disabled).
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``tb-evict=on|off``
+        When the TCG translation block cache is about to fill up, discard
+        the translated code of the region that was filled longest ago and
+        has not been used recently, instead of stopping all vCPUs to flush
+        the whole cache. Useful for guests whose working set of code does
+        not fit in ``tb-size``. Requires ``thread=multi``. The default is
+        off.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
@@ -245,6 +274,20 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is enabled, it sets the number of threads
+        that collect the rings of all vCPUs, each thread handling a share
+        of the vCPUs.  Guests with many vCPUs that dirty memory quickly
+        can use more threads so that the rings are emptied before they
+        fill up and force vCPU exits.  The default is 1, the maximum is 64.
+
+    ``dirty-sync-threads=n``
+        Sets the number of threads that merge the dirty bitmap of a KVM
+        memory slot into QEMU's own dirty bitmaps when it is synced, for
+        example at the start of each migration iteration.  Only slots of
+        at least 262144 host pages (1 GiB with 4 KiB pages) are split
+        between threads.  The default is 1, the maximum is 64.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -2885,6 +2928,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
 #ifdef CONFIG_AF_XDP
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
+    "         [,batch-size=n][,busy-poll=on|off]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
@@ -2894,6 +2938,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                  added to a socket map in XDP program.  One socket per queue.\n"
     "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
     "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'batch-size=n' to specify how many packets are handled per queue in one go (default: 64)\n"
+    "                use 'busy-poll=on|off' to busy poll the sockets (default: off)\n"
 #endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
@@ -3395,7 +3441,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,batch-size=n][,busy-poll=on|off]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -3444,6 +3490,22 @@ SRST
         |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
             -netdev af-xdp,id=n1,ifname=eth0,queues=3,inhibit=on,sock-fds=15:16:17
 
+    'batch-size' limits the number of packets received from and buffers
+    refilled into the rings of each queue at once, defaults to 64.  With
+    'busy-poll=on' the sockets are configured for preferred busy polling.
+    Combined with virtio-net's 'iothreads' property, every queue is then
+    serviced from the polling loop of its IOThread, which should have
+    'poll-max-ns' set.  Ring-full and wakeup counters are shown by the
+    ``info network`` monitor command.
+
+    .. parsed-literal::
+
+        |qemu_system| linux.img \\
+            -object iothread,id=io0,poll-max-ns=50000 \\
+            -object iothread,id=io1,poll-max-ns=50000 \\
+            -device virtio-net-pci,netdev=n1,mq=on,vectors=6,len-iothreads=2,iothreads[0]=io0,iothreads[1]=io1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=2,busy-poll=on,batch-size=128
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -127,6 +127,22 @@ enum ListenerDirection { Forward, Reverse };
         }                                                               \
     } while (0)
 
+/*
+ * Like MEMORY_LISTENER_CALL_GLOBAL(_callback, Forward), but skip listeners
+ * of address spaces that keep their FlatView across the transaction.
+ */
+#define MEMORY_LISTENER_CALL_CHANGED(_callback)                         \
+    do {                                                                \
+        MemoryListener *_listener;                                      \
+                                                                        \
+        QTAILQ_FOREACH(_listener, &memory_listeners, link) {            \
+            if (_listener->_callback &&                                 \
+                _listener->address_space->flatview_changed) {           \
+                _listener->_callback(_listener);                        \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
 #define MEMORY_LISTENER_CALL(_as, _callback, _direction, _section, _args...) \
     do {                                                                \
         MemoryListener *_listener;                                      \
@@ -260,6 +276,7 @@ static FlatView *flatview_new(MemoryRegion *mr_root)
     view = g_new0(FlatView, 1);
     view->ref = 1;
     view->root = mr_root;
+    view->rendered = g_hash_table_new(g_direct_hash, g_direct_equal);
     memory_region_ref(mr_root);
     trace_flatview_new(view, mr_root);
 
@@ -295,6 +312,7 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    g_hash_table_unref(view->rendered);
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -609,6 +627,12 @@ static void render_memory_region(FlatView *view,
     FlatRange fr;
     AddrRange tmp;
 
+    /*
+     * Record even regions that end up disabled or clipped, changing
+     * them can make them visible.
+     */
+    g_hash_table_add(view->rendered, mr);
+
     if (!mr->enabled) {
         return;
     }
@@ -1023,33 +1047,106 @@ static void flatviews_init(void)
     }
 }
 
-static void flatviews_reset(void)
+/*
+ * A region that affects rendering changed: mark stale the FlatViews that
+ * rendered it or one of its containers.  A region that was not rendered
+ * into a view can only become visible in it through a change to one of
+ * the regions that were, so the other views are kept as they are.
+ */
+static void memory_region_mark_update(MemoryRegion *mr)
 {
-    AddressSpace *as;
+    GHashTableIter iter;
+    FlatView *view;
+    MemoryRegion *p;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+    memory_region_update_pending = true;
+    if (!flat_views) {
+        return;
     }
+
+    g_hash_table_iter_init(&iter, flat_views);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&view)) {
+        if (view->stale) {
+            continue;
+        }
+        for (p = mr; p; p = p->container) {
+            if (g_hash_table_contains(view->rendered, p)) {
+                view->stale = true;
+                break;
+            }
+        }
+    }
+}
+
+/* Something that affects all regions changed, e.g. global dirty logging */
+static void flatviews_mark_stale(void)
+{
+    GHashTableIter iter;
+    FlatView *view;
+
+    memory_region_update_pending = true;
+    if (!flat_views) {
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, flat_views);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&view)) {
+        view->stale = true;
+    }
+}
+
+/* Totals over the whole run, shown by "info mtree -f" */
+static uint64_t flatviews_rendered, flatviews_reused;
+
+static void flatviews_update(void)
+{
+    GHashTable *old_views = flat_views;
+    unsigned int rendered = 0, reused = 0;
+    AddressSpace *as;
+
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, keeping those that no change touched */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && !view->stale) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+            reused++;
+            continue;
+        }
+
         generate_memory_topology(physmr);
+        rendered++;
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    flatviews_rendered += rendered;
+    flatviews_reused += reused;
+    trace_flatviews_update(rendered, reused);
+}
+
+static FlatView *address_space_lookup_flatview(AddressSpace *as)
+{
+    MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+    return g_hash_table_lookup(flat_views, physmr);
 }
 
 static void address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
-    MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
-    FlatView *new_view = g_hash_table_lookup(flat_views, physmr);
+    FlatView *new_view = address_space_lookup_flatview(as);
 
     assert(new_view);
 
@@ -1117,17 +1214,34 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatviews_update();
 
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            /*
+             * Address spaces share a view when they have the same
+             * flatview root; bus master address spaces of enabled PCI
+             * devices all share the one of system memory.  A change to
+             * system memory therefore still re-renders that view and
+             * updates all of them; only address spaces with other roots
+             * are skipped.
+             */
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                as->flatview_changed = address_space_to_flatview(as) !=
+                                       address_space_lookup_flatview(as);
+            }
+
+            MEMORY_LISTENER_CALL_CHANGED(begin);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (as->flatview_changed) {
+                    address_space_set_flatview(as);
+                    address_space_update_ioeventfds(as);
+                } else if (ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            MEMORY_LISTENER_CALL_CHANGED(commit);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -2243,7 +2357,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2373,7 +2489,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2383,7 +2501,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2393,7 +2513,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_update(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2638,7 +2760,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2688,7 +2812,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2699,7 +2825,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_mark_update(mr);
     memory_region_transaction_commit();
 }
 
@@ -2715,7 +2841,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_mark_update(mr);
     memory_region_transaction_commit();
 }
 
@@ -2751,7 +2877,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_update(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2922,7 +3050,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        flatviews_mark_stale();
         memory_region_transaction_commit();
     }
 }
@@ -2937,7 +3065,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        flatviews_mark_stale();
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -3413,6 +3541,7 @@ static void mtree_print_flatview(gpointer key, gpointer value,
     }
 
 #if !defined(CONFIG_USER_ONLY)
+    mtree_print_dispatch_cache(view->dispatch);
     if (fvi->dispatch_tree && view->root) {
         mtree_print_dispatch(view->dispatch, view->root);
     }
@@ -3465,6 +3594,8 @@ static void mtree_info_flatview(bool dispatch_tree, bool owner)
 
     /* Print */
     g_hash_table_foreach(views, mtree_print_flatview, &fvi);
+    qemu_printf("FlatView updates: %" PRIu64 " rendered, %" PRIu64
+                " reused\n", flatviews_rendered, flatviews_reused);
 
     /* Free */
     g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
@@ -129,6 +129,11 @@ typedef struct PhysPageMap {
 
 struct AddressSpaceDispatch {
     MemoryRegionSection *mru_section;
+    /* Never reused, tags the entries of phys_lookup_cache */
+    uint64_t gen;
+    /* Not incremented atomically, so only approximate */
+    size_t lookup_hits;
+    size_t lookup_misses;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -332,6 +337,50 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
     }
 }
 
+/*
+ * Small direct-mapped cache of phys_page_find() results, private to each
+ * thread so that vCPUs hammering different doorbells, or an IOThread
+ * doing DMA, do not evict each other like they do with mru_section.
+ * Entries are tagged with the generation of the dispatch they were
+ * looked up in; a new FlatView gets a new generation, so there is
+ * nothing to flush when the memory map changes.  The section an entry
+ * points to stays valid as long as the dispatch with that generation,
+ * which the caller keeps alive through RCU.
+ */
+#define PHYS_LOOKUP_CACHE_BITS 6
+#define PHYS_LOOKUP_CACHE_SIZE (1 << PHYS_LOOKUP_CACHE_BITS)
+
+typedef struct PhysLookupEntry {
+    uint64_t gen;
+    hwaddr index;
+    MemoryRegionSection *section;
+} PhysLookupEntry;
+
+static __thread PhysLookupEntry phys_lookup_cache[PHYS_LOOKUP_CACHE_SIZE];
+static uint64_t phys_dispatch_gen;
+
+/* Called from RCU critical section */
+static MemoryRegionSection *phys_page_find_cached(AddressSpaceDispatch *d,
+                                                  hwaddr addr)
+{
+    hwaddr index = addr >> TARGET_PAGE_BITS;
+    PhysLookupEntry *e;
+
+    e = &phys_lookup_cache[(index ^ (index >> PHYS_LOOKUP_CACHE_BITS) ^ d->gen)
+                           & (PHYS_LOOKUP_CACHE_SIZE - 1)];
+    if (e->gen == d->gen && e->index == index &&
+        section_covers_addr(e->section, addr)) {
+        qatomic_set(&d->lookup_hits, d->lookup_hits + 1);
+        return e->section;
+    }
+
+    qatomic_set(&d->lookup_misses, d->lookup_misses + 1);
+    e->gen = d->gen;
+    e->index = index;
+    e->section = phys_page_find(d, addr);
+    return e->section;
+}
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
@@ -342,7 +391,7 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
 
     if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
         !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
+        section = phys_page_find_cached(d, addr);
         qatomic_set(&d->mru_section, section);
     }
     if (resolve_subpage && section->mr->subpage) {
@@ -2475,6 +2524,8 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    /* Starts at 1, zeroed cache entries must never match */
+    d->gen = ++phys_dispatch_gen;
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
 
@@ -3689,6 +3740,19 @@ void mtree_print_dispatch(AddressSpaceDispatch *d, MemoryRegion *root)
     }
 }
 
+void mtree_print_dispatch_cache(AddressSpaceDispatch *d)
+{
+    size_t hits = qatomic_read(&d->lookup_hits);
+    size_t misses = qatomic_read(&d->lookup_misses);
+    unsigned int rate = 0;
+
+    if (hits + misses) {
+        rate = (uint64_t)hits * 100 / (hits + misses);
+    }
+    qemu_printf("  Lookup cache: %zu hits, %zu misses (%u%% hit rate)\n",
+                hits, misses, rate);
+}
+
 /* Require any discards to work. */
 static unsigned int ram_block_discard_required_cnt;
 /* Require only coordinated discards to work. */
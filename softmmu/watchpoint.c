@@ -22,6 +22,7 @@
 #include "qemu/error-report.h"
 #include "exec/exec-all.h"
 #include "exec/translate-all.h"
+#include "exec/tb-flush.h"
 #include "sysemu/tcg.h"
 #include "sysemu/replay.h"
 #include "hw/core/tcg-cpu-ops.h"
@@ -59,6 +60,9 @@ int cpu_watchpoint_insert(CPUState *cpu, vaddr addr, vaddr len,
     } else {
         tlb_flush(cpu);
     }
+    if (flags & BP_MEM_READ) {
+        tb_direct_ram_watchpoint(cpu, true);
+    }
 
     if (watchpoint) {
         *watchpoint = wp;
@@ -88,6 +92,9 @@ void cpu_watchpoint_remove_by_ref(CPUState *cpu, CPUWatchpoint *watchpoint)
     QTAILQ_REMOVE(&cpu->watchpoints, watchpoint, entry);
 
     tlb_flush_page(cpu, watchpoint->vaddr);
+    if (watchpoint->flags & BP_MEM_READ) {
+        tb_direct_ram_watchpoint(cpu, false);
+    }
 
     g_free(watchpoint);
 }
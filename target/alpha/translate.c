@@ -2885,6 +2885,10 @@ static void alpha_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
 #else
     ctx->palbr = env->palbr;
     ctx->ir = (ctx->tbflags & ENV_FLAG_PAL_MODE ? cpu_pal_ir : cpu_std_ir);
+
+    /* Physical accesses, and the kernel's KSEG, map RAM linearly.  */
+    tcg_set_direct_ram(MMU_PHYS_IDX, 0, UINT64_MAX);
+    tcg_set_direct_ram(MMU_KERNEL_IDX, 0xfffffc0000000000ull, 1ull << 40);
 #endif
 
     /* ??? Every TB begins with unset rounding mode, to be initialized on
@@ -25,11 +25,29 @@
 #include "exec/cpu_ldst.h"
 #include "tcg/helper-tcg.h"
 #include "tcg/seg_helper.h"
+#ifdef CONFIG_LINUX_USER
+#include "user/syscall-fast.h"
+#endif
 
 void helper_syscall(CPUX86State *env, int next_eip_addend)
 {
     CPUState *cs = env_cpu(env);
 
+#if defined(CONFIG_LINUX_USER) && defined(TARGET_X86_64)
+    abi_long ret;
+
+    /*
+     * Cheap, read-only syscalls complete here, and execution continues
+     * with the next instruction without a trip through the cpu loop.
+     */
+    if (do_syscall_fast(env, env->regs[R_EAX], env->regs[R_EDI],
+                        env->regs[R_ESI], &ret)) {
+        env->regs[R_EAX] = ret;
+        env->eip += next_eip_addend;
+        return;
+    }
+#endif
+
     cs->exception_index = EXCP_SYSCALL;
     env->exception_is_int = 0;
     env->exception_next_eip = env->eip + next_eip_addend;
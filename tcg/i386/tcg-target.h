@@ -206,6 +206,12 @@ typedef enum {
 #define TCG_TARGET_HAS_v64              have_avx1
 #define TCG_TARGET_HAS_v128             have_avx1
 #define TCG_TARGET_HAS_v256             have_avx2
+/*
+ * 512-bit vectors need EVEX forms of the byte and word insns (BW) and of
+ * the quadword multiply (DQ); dup2 is only provided for 256 bits and less.
+ */
+#define TCG_TARGET_HAS_v512 \
+    (TCG_TARGET_REG_BITS == 64 && have_avx512bw && have_avx512dq)
 
 #define TCG_TARGET_HAS_andc_vec         1
 #define TCG_TARGET_HAS_orc_vec          have_avx512vl
@@ -225,7 +231,7 @@ typedef enum {
 #define TCG_TARGET_HAS_sat_vec          1
 #define TCG_TARGET_HAS_minmax_vec       1
 #define TCG_TARGET_HAS_bitsel_vec       have_avx512vl
-#define TCG_TARGET_HAS_cmpsel_vec       -1
+#define TCG_TARGET_HAS_cmpsel_vec       1
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && ((len) == 8 || (len) == 16)) || \
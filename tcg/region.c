@@ -52,6 +52,25 @@ struct tcg_region_tree {
     /* padding to avoid false sharing is computed at run-time */
 };
 
+/*
+ * Life cycle of a region.  Without eviction, regions only ever go from
+ * FREE to ACTIVE to FULL, and tcg_region_reset_all frees them all at once.
+ * With eviction, the coldest FULL region is emptied of TBs and waits in
+ * EVICTING for an RCU grace period before it becomes FREE again.
+ */
+enum {
+    REGION_FREE,
+    REGION_ACTIVE,      /* owned by a TCGContext */
+    REGION_FULL,
+    REGION_EVICTING,
+};
+
+struct tcg_region_info {
+    uint8_t state;
+    bool referenced;    /* one of its TBs was looked up since the last pass */
+    uint64_t gen;       /* age, for picking eviction victims */
+};
+
 /*
  * We divide code_gen_buffer into equally-sized "regions" that TCG threads
  * dynamically allocate from as demand dictates. Given appropriate region
@@ -68,9 +87,16 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    bool evict; /* evict cold regions before running out of space */
+    size_t evict_watermark; /* keep at least this many regions free */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    struct tcg_region_info *info;
+    size_t n_free;
+    size_t n_full;
+    size_t n_evicting;
+    uint64_t gen;
+    unsigned epoch; /* incremented by tcg_region_reset_all */
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
@@ -191,7 +217,8 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, or -1 if none. */
+static ssize_t tc_ptr_to_region_idx(const void *p)
 {
     size_t region_idx;
 
@@ -202,7 +229,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
     if (!in_code_gen_buffer(p)) {
         p -= tcg_splitwx_diff;
         if (!in_code_gen_buffer(p)) {
-            return NULL;
+            return -1;
         }
     }
 
@@ -217,6 +244,16 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             region_idx = offset / region.stride;
         }
     }
+    return region_idx;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
+    ssize_t region_idx = tc_ptr_to_region_idx(p);
+
+    if (region_idx < 0) {
+        return NULL;
+    }
     return region_trees + region_idx * tree_size;
 }
 
@@ -359,11 +396,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i;
+
+    if (region.n_free == 0) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    for (i = 0; region.info[i].state != REGION_FREE; i++) {
+        continue;
+    }
+    region.info[i].state = REGION_ACTIVE;
+    qatomic_set(&region.n_free, region.n_free - 1);
+    tcg_region_assign(s, i);
     return false;
 }
 
@@ -376,11 +419,16 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full = tc_ptr_to_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.info[full].state = REGION_FULL;
+        region.info[full].referenced = false;
+        region.info[full].gen = ++region.gen;
+        qatomic_set(&region.n_full, region.n_full + 1);
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -410,7 +458,13 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
+    for (i = 0; i < region.n; i++) {
+        region.info[i].state = REGION_FREE;
+    }
+    qatomic_set(&region.n_free, region.n);
+    qatomic_set(&region.n_full, 0);
+    qatomic_set(&region.n_evicting, 0);
+    region.epoch++;
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -422,6 +476,139 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Eviction of cold regions.  Instead of flushing the whole code buffer
+ * once the last region has been handed out, the oldest full region is
+ * recycled whenever fewer than evict_watermark regions are left free.
+ * "Oldest" is approximated with a second-chance clock: a region whose
+ * TBs were looked up or chained to since it was last considered is moved
+ * to the back of the queue instead.
+ *
+ * The caller invalidates the TBs of the victim between
+ * tcg_region_evict_begin and tcg_region_evict_end, and must let an RCU
+ * grace period elapse before the latter so that no vCPU can still be
+ * executing code from the region.
+ */
+void tcg_region_enable_eviction(void)
+{
+    /* Regions owned by the contexts cannot be evicted.  */
+    if (region.n <= tcg_max_ctxs) {
+        return;
+    }
+    region.evict_watermark = MAX(1, region.n / 8);
+    region.evict = true;
+}
+
+bool tcg_region_evict_wanted(void)
+{
+    return region.evict &&
+           qatomic_read(&region.n_full) != 0 &&
+           qatomic_read(&region.n_free) + qatomic_read(&region.n_evicting) <
+           region.evict_watermark;
+}
+
+/*
+ * Pick an eviction victim and mark it as being evicted.  Returns the
+ * index of the region, or -1 if none should be evicted.  @pepoch is set
+ * to the value to be passed on to tcg_region_evict_end.
+ */
+ssize_t tcg_region_evict_begin(unsigned *pepoch)
+{
+    ssize_t victim = -1;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_free + region.n_evicting >= region.evict_watermark) {
+        goto out;
+    }
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_info *ri = &region.info[i];
+
+        if (ri->state == REGION_FULL && !qatomic_read(&ri->referenced) &&
+            (victim < 0 || ri->gen < region.info[victim].gen)) {
+            victim = i;
+        }
+    }
+    /* Older regions that were referenced get their second chance.  */
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_info *ri = &region.info[i];
+
+        if (ri->state == REGION_FULL && qatomic_read(&ri->referenced) &&
+            (victim < 0 || ri->gen < region.info[victim].gen)) {
+            qatomic_set(&ri->referenced, false);
+            ri->gen = ++region.gen;
+        }
+    }
+    /* If all of them were referenced, fall back to the oldest one.  */
+    if (victim < 0) {
+        for (i = 0; i < region.n; i++) {
+            if (region.info[i].state == REGION_FULL &&
+                (victim < 0 || region.info[i].gen < region.info[victim].gen)) {
+                victim = i;
+            }
+        }
+    }
+    if (victim >= 0) {
+        region.info[victim].state = REGION_EVICTING;
+        qatomic_set(&region.n_full, region.n_full - 1);
+        qatomic_set(&region.n_evicting, region.n_evicting + 1);
+        *pepoch = region.epoch;
+    }
+ out:
+    qemu_mutex_unlock(&region.lock);
+    return victim;
+}
+
+/* Call @func on all TBs of region @idx, with its tree lock held. */
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Return region @idx to the free pool, unless the whole buffer was reset
+ * since tcg_region_evict_begin returned @epoch.
+ */
+void tcg_region_evict_end(size_t idx, unsigned epoch)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&region.lock);
+    if (epoch == region.epoch) {
+        g_assert(region.info[idx].state == REGION_EVICTING);
+
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        q_tree_ref(rt->tree);
+        q_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        tcg_region_bounds(idx, &start, &end);
+        region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+        region.info[idx].state = REGION_FREE;
+        qatomic_set(&region.n_evicting, region.n_evicting - 1);
+        qatomic_set(&region.n_free, region.n_free + 1);
+    }
+    qemu_mutex_unlock(&region.lock);
+}
+
+/* Note that the TB at @tc_ptr is in use, for the benefit of eviction. */
+void tcg_region_touch(const void *tc_ptr)
+{
+    if (region.evict) {
+        ssize_t idx = tc_ptr_to_region_idx(tc_ptr);
+
+        if (idx >= 0 && !qatomic_read(&region.info[idx].referenced)) {
+            qatomic_set(&region.info[idx].referenced, true);
+        }
+    }
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -810,6 +997,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.info = g_new0(struct tcg_region_info, region.n);
+    region.n_free = region.n;
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
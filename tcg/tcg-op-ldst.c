@@ -214,11 +214,179 @@ static void tcg_gen_qemu_ld_i32_int(TCGv_i32 val, TCGTemp *addr,
     }
 }
 
+static void tcg_gen_qemu_ld_i64_int(TCGv_i64 val, TCGTemp *addr,
+                                    TCGArg idx, MemOp memop);
+
+void tcg_set_direct_ram(int mmu_idx, uint64_t vbase, uint64_t phys_limit)
+{
+    const TCGDirectRAM *d = &tcg_ctx->direct_ram;
+
+    tcg_debug_assert(mmu_idx < ARRAY_SIZE(tcg_ctx->direct_ram_vbase));
+    if (TCG_TARGET_REG_BITS == 64 && d->size &&
+        d->base + d->size <= phys_limit) {
+        tcg_ctx->direct_ram_idxmap |= 1u << mmu_idx;
+        tcg_ctx->direct_ram_vbase[mmu_idx] = vbase;
+    }
+}
+
+static bool use_direct_ram(TCGTemp *val, TCGTemp *addr, TCGArg idx)
+{
+    if (!(tcg_ctx->direct_ram_idxmap & (1u << idx))) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    /* The memory callbacks use a copy of the address in an EBB temp.  */
+    if (tcg_ctx->plugin_insn != NULL) {
+        return false;
+    }
+#endif
+    /* Both are live across the label of the fallback path.  */
+    return val->kind != TEMP_EBB && addr->kind != TEMP_EBB;
+}
+
+/*
+ * Load @val from the host mapping of the direct RAM window if @addr is
+ * within it, and through the softmmu TLB otherwise.  The range and the
+ * alignment are checked at once, by rotating the low bits of the offset
+ * that must be zero into the high bits.
+ */
+static void gen_direct_ram_ld(TCGTemp *val, TCGTemp *addr,
+                              TCGArg idx, MemOp memop)
+{
+    const TCGDirectRAM *d = &tcg_ctx->direct_ram;
+    unsigned a_bits = get_alignment_bits(memop);
+    uint64_t lo = tcg_ctx->direct_ram_vbase[idx] + d->base;
+    TCGLabel *l_slow = gen_new_label();
+    TCGLabel *l_done = gen_new_label();
+    TCGv_i64 off = tcg_temp_ebb_new_i64();
+    TCGv_i64 t = tcg_temp_ebb_new_i64();
+    TCGv_ptr host = tcg_temp_ebb_new_ptr();
+    MemOp lmemop = memop;
+
+    if (tcg_ctx->addr_type == TCG_TYPE_I32) {
+        tcg_gen_extu_i32_i64(off, temp_tcgv_i32(addr));
+    } else {
+        tcg_gen_mov_i64(off, temp_tcgv_i64(addr));
+    }
+    tcg_gen_subi_i64(off, off, lo);
+    tcg_gen_rotri_i64(t, off, a_bits);
+    tcg_gen_brcondi_i64(TCG_COND_GTU, t,
+                        (d->size - memop_size(memop)) >> a_bits, l_slow);
+    tcg_temp_free_i64(t);
+
+    tcg_gen_trunc_i64_ptr(host, off);
+    tcg_gen_addi_ptr(host, host, d->host);
+    tcg_temp_free_i64(off);
+
+    tcg_gen_req_mo(TCG_MO_LD_LD | TCG_MO_ST_LD);
+    if (memop & MO_BSWAP) {
+        lmemop &= ~MO_SIGN;
+    }
+    if (val->base_type == TCG_TYPE_I32) {
+        TCGv_i32 v = temp_tcgv_i32(val);
+
+        switch (lmemop & MO_SSIZE) {
+        case MO_UB:
+            tcg_gen_ld8u_i32(v, host, 0);
+            break;
+        case MO_SB:
+            tcg_gen_ld8s_i32(v, host, 0);
+            break;
+        case MO_UW:
+            tcg_gen_ld16u_i32(v, host, 0);
+            break;
+        case MO_SW:
+            tcg_gen_ld16s_i32(v, host, 0);
+            break;
+        case MO_UL:
+            tcg_gen_ld_i32(v, host, 0);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        if (memop & MO_BSWAP) {
+            switch (memop & MO_SIZE) {
+            case MO_16:
+                tcg_gen_bswap16_i32(v, v, (memop & MO_SIGN
+                                           ? TCG_BSWAP_IZ | TCG_BSWAP_OS
+                                           : TCG_BSWAP_IZ | TCG_BSWAP_OZ));
+                break;
+            case MO_32:
+                tcg_gen_bswap32_i32(v, v);
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+    } else {
+        TCGv_i64 v = temp_tcgv_i64(val);
+        int flags = (memop & MO_SIGN
+                     ? TCG_BSWAP_IZ | TCG_BSWAP_OS
+                     : TCG_BSWAP_IZ | TCG_BSWAP_OZ);
+
+        switch (lmemop & MO_SSIZE) {
+        case MO_UB:
+            tcg_gen_ld8u_i64(v, host, 0);
+            break;
+        case MO_SB:
+            tcg_gen_ld8s_i64(v, host, 0);
+            break;
+        case MO_UW:
+            tcg_gen_ld16u_i64(v, host, 0);
+            break;
+        case MO_SW:
+            tcg_gen_ld16s_i64(v, host, 0);
+            break;
+        case MO_UL:
+            tcg_gen_ld32u_i64(v, host, 0);
+            break;
+        case MO_SL:
+            tcg_gen_ld32s_i64(v, host, 0);
+            break;
+        case MO_UQ:
+            tcg_gen_ld_i64(v, host, 0);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        if (memop & MO_BSWAP) {
+            switch (memop & MO_SIZE) {
+            case MO_16:
+                tcg_gen_bswap16_i64(v, v, flags);
+                break;
+            case MO_32:
+                tcg_gen_bswap32_i64(v, v, flags);
+                break;
+            case MO_64:
+                tcg_gen_bswap64_i64(v, v);
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+    }
+    tcg_temp_free_ptr(host);
+    tcg_gen_br(l_done);
+
+    gen_set_label(l_slow);
+    if (val->base_type == TCG_TYPE_I32) {
+        tcg_gen_qemu_ld_i32_int(temp_tcgv_i32(val), addr, idx, memop);
+    } else {
+        tcg_gen_qemu_ld_i64_int(temp_tcgv_i64(val), addr, idx, memop);
+    }
+    gen_set_label(l_done);
+}
+
 void tcg_gen_qemu_ld_i32_chk(TCGv_i32 val, TCGTemp *addr, TCGArg idx,
                              MemOp memop, TCGType addr_type)
 {
     tcg_debug_assert(addr_type == tcg_ctx->addr_type);
     tcg_debug_assert((memop & MO_SIZE) <= MO_32);
+    if (use_direct_ram(tcgv_i32_temp(val), addr, idx)) {
+        gen_direct_ram_ld(tcgv_i32_temp(val), addr, idx,
+                          tcg_canonicalize_memop(memop, 0, 0));
+        return;
+    }
     tcg_gen_qemu_ld_i32_int(val, addr, idx, memop);
 }
 
@@ -344,6 +512,11 @@ void tcg_gen_qemu_ld_i64_chk(TCGv_i64 val, TCGTemp *addr, TCGArg idx,
 {
     tcg_debug_assert(addr_type == tcg_ctx->addr_type);
     tcg_debug_assert((memop & MO_SIZE) <= MO_64);
+    if (use_direct_ram(tcgv_i64_temp(val), addr, idx)) {
+        gen_direct_ram_ld(tcgv_i64_temp(val), addr, idx,
+                          tcg_canonicalize_memop(memop, 1, 0));
+        return;
+    }
     tcg_gen_qemu_ld_i64_int(val, addr, idx, memop);
 }
 
@@ -0,0 +1,210 @@
+/*
+ * Check that per-vCPU inline ops and conditional callbacks agree with
+ * regular callbacks.
+ *
+ * Every event is counted twice per vCPU, once from a callback and once
+ * inline, and the two must match exactly whatever the number of vCPUs.
+ * A conditional callback fires each time an inline instruction counter
+ * reaches a threshold and resets it, so the number of hits follows from
+ * the instruction count. Memory accesses are also recorded to a trace
+ * buffer, whose records must add up to the same count.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define COND_THRESHOLD 100
+
+typedef struct {
+    uint64_t count_tb;
+    uint64_t count_tb_inline;
+    uint64_t count_insn;
+    uint64_t count_insn_inline;
+    uint64_t count_mem;
+    uint64_t count_mem_inline;
+    uint64_t cond_track;
+    uint64_t cond_hits;
+    uint64_t count_mem_trace;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 count_tb;
+static qemu_plugin_u64 count_tb_inline;
+static qemu_plugin_u64 count_insn;
+static qemu_plugin_u64 count_insn_inline;
+static qemu_plugin_u64 count_mem;
+static qemu_plugin_u64 count_mem_inline;
+static qemu_plugin_u64 cond_track;
+static qemu_plugin_u64 cond_hits;
+static qemu_plugin_u64 count_mem_trace;
+static struct qemu_plugin_mem_buf *mem_trace;
+
+static void stats_insn(void)
+{
+    const uint64_t expected = qemu_plugin_u64_sum(count_insn);
+    const uint64_t per_vcpu = qemu_plugin_u64_sum(count_insn_inline);
+    uint64_t expected_hits = 0;
+
+    for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        uint64_t n = qemu_plugin_u64_get(count_insn, i);
+
+        g_assert(qemu_plugin_u64_get(count_insn_inline, i) == n);
+        g_assert(qemu_plugin_u64_get(cond_hits, i) == n / COND_THRESHOLD);
+        g_assert(qemu_plugin_u64_get(cond_track, i) == n % COND_THRESHOLD);
+        expected_hits += n / COND_THRESHOLD;
+    }
+    printf("insn: %" PRIu64 "\n", expected);
+    printf("insn: %" PRIu64 " (per vcpu)\n", per_vcpu);
+    printf("insn: %" PRIu64 " (cond cb hits)\n",
+           qemu_plugin_u64_sum(cond_hits));
+    g_assert(expected > 0);
+    g_assert(per_vcpu == expected);
+    g_assert(qemu_plugin_u64_sum(cond_hits) == expected_hits);
+}
+
+static void stats_tb(void)
+{
+    const uint64_t expected = qemu_plugin_u64_sum(count_tb);
+    const uint64_t per_vcpu = qemu_plugin_u64_sum(count_tb_inline);
+
+    for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        g_assert(qemu_plugin_u64_get(count_tb_inline, i) ==
+                 qemu_plugin_u64_get(count_tb, i));
+    }
+    printf("tb: %" PRIu64 "\n", expected);
+    printf("tb: %" PRIu64 " (per vcpu)\n", per_vcpu);
+    g_assert(expected > 0);
+    g_assert(per_vcpu == expected);
+}
+
+static void stats_mem(void)
+{
+    const uint64_t expected = qemu_plugin_u64_sum(count_mem);
+    const uint64_t per_vcpu = qemu_plugin_u64_sum(count_mem_inline);
+    const uint64_t traced = qemu_plugin_u64_sum(count_mem_trace);
+
+    for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        g_assert(qemu_plugin_u64_get(count_mem_inline, i) ==
+                 qemu_plugin_u64_get(count_mem, i));
+        g_assert(qemu_plugin_u64_get(count_mem_trace, i) ==
+                 qemu_plugin_u64_get(count_mem, i));
+    }
+    printf("mem: %" PRIu64 "\n", expected);
+    printf("mem: %" PRIu64 " (per vcpu)\n", per_vcpu);
+    printf("mem: %" PRIu64 " (trace)\n", traced);
+    g_assert(expected > 0);
+    g_assert(per_vcpu == expected);
+    g_assert(traced == expected);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    stats_tb();
+    stats_insn();
+    stats_mem();
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(count_tb, cpu_index, 1);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(count_insn, cpu_index, 1);
+}
+
+static void vcpu_insn_cond(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_set(cond_track, cpu_index, 0);
+    qemu_plugin_u64_add(cond_hits, cpu_index, 1);
+}
+
+static void vcpu_mem_access(unsigned int cpu_index,
+                            qemu_plugin_meminfo_t info,
+                            uint64_t vaddr,
+                            void *userdata)
+{
+    qemu_plugin_u64_add(count_mem, cpu_index, 1);
+}
+
+static void vcpu_mem_trace(unsigned int cpu_index,
+                           const struct qemu_plugin_mem_record *records,
+                           size_t n, void *userdata)
+{
+    qemu_plugin_u64_add(count_mem_trace, cpu_index, n);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, count_tb_inline, 1);
+
+    for (int idx = 0; idx < qemu_plugin_tb_n_insns(tb); ++idx) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, idx);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, NULL);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, count_insn_inline, 1);
+
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, cond_track, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_insn_cond, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_EQ, cond_track, COND_THRESHOLD, NULL);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, &vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            count_mem_inline, 1);
+        qemu_plugin_register_vcpu_mem_trace(insn, QEMU_PLUGIN_MEM_RW,
+                                            mem_trace);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    count_tb = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_tb);
+    count_tb_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_tb_inline);
+    count_insn = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_insn);
+    count_insn_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_insn_inline);
+    count_mem = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem);
+    count_mem_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem_inline);
+    cond_track = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, cond_track);
+    cond_hits = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, cond_hits);
+    count_mem_trace = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem_trace);
+    mem_trace = qemu_plugin_mem_buf_new(vcpu_mem_trace, 1024, NULL);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
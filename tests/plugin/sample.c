@@ -0,0 +1,140 @@
+/*
+ * Check that sampled instrumentation covers the expected share of the
+ * execution.
+ *
+ * Instrumented TBs are counted per vCPU.  With mode=tbs, expect=N gives
+ * the number of TBs a run with mode=none counted; the sampled count must
+ * then be close to window / period of it.  With mode=time, every
+ * instrumented TB looks at the host clock, and most of them must run
+ * within a window of the period, as measured from plugin installation.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* time mode: allowed delay before a vCPU notices the end of a window */
+#define TIME_SLACK_NS (1000 * 1000)
+
+typedef struct {
+    uint64_t count_tb;
+    uint64_t in_window;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 count_tb;
+static qemu_plugin_u64 in_window;
+
+static enum { SAMPLE_NONE, SAMPLE_TBS, SAMPLE_TIME } mode = SAMPLE_TBS;
+static uint64_t period = 1000;
+static uint64_t window = 100;
+static uint64_t expect;
+static int64_t start_ns;
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    const uint64_t tbs = qemu_plugin_u64_sum(count_tb);
+    g_autoptr(GString) out = g_string_new("");
+
+    g_string_printf(out, "tbs: %" PRIu64 "\n", tbs);
+    g_assert(tbs > 0);
+
+    if (mode == SAMPLE_TBS && expect) {
+        /* allow for a partial window at the end of each vCPU's run */
+        uint64_t lo = expect / period * window * 8 / 10;
+        uint64_t hi = (expect / period + qemu_plugin_num_vcpus()) *
+                      window * 12 / 10;
+
+        g_string_append_printf(out, "expected: %" PRIu64 "..%" PRIu64 "\n",
+                               lo, hi);
+        g_assert(tbs >= lo && tbs <= hi);
+    } else if (mode == SAMPLE_TIME) {
+        const uint64_t good = qemu_plugin_u64_sum(in_window);
+
+        g_string_append_printf(out, "in window: %" PRIu64 "\n", good);
+        g_assert(good >= tbs * 3 / 4);
+    }
+    qemu_plugin_outs(out->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec_time(unsigned int cpu_index, void *udata)
+{
+    uint64_t t = g_get_monotonic_time() * 1000 - start_ns;
+
+    if (t % period < window + TIME_SLACK_NS) {
+        qemu_plugin_u64_add(in_window, cpu_index, 1);
+    }
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, count_tb, 1);
+    if (mode == SAMPLE_TIME) {
+        qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec_time,
+                                             QEMU_PLUGIN_CB_NO_REGS, NULL);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "mode") == 0) {
+            if (g_strcmp0(tokens[1], "none") == 0) {
+                mode = SAMPLE_NONE;
+            } else if (g_strcmp0(tokens[1], "tbs") == 0) {
+                mode = SAMPLE_TBS;
+            } else if (g_strcmp0(tokens[1], "time") == 0) {
+                mode = SAMPLE_TIME;
+            } else {
+                fprintf(stderr, "invalid mode: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "period") == 0) {
+            period = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "window") == 0) {
+            window = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "expect") == 0) {
+            expect = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    if (mode != SAMPLE_NONE &&
+        qemu_plugin_register_sampling(id, mode == SAMPLE_TBS ?
+                                      QEMU_PLUGIN_SAMPLE_TBS :
+                                      QEMU_PLUGIN_SAMPLE_TIME,
+                                      period, window)) {
+        fprintf(stderr, "invalid sampling parameters\n");
+        return -1;
+    }
+    start_ns = g_get_monotonic_time() * 1000;
+
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    count_tb = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_tb);
+    in_window = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, in_window);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Memory topology commit benchmark
+ *
+ * Moves a PCI BAR back and forth on machines with a growing number of
+ * PCI devices, each with bus mastering enabled and therefore its own
+ * address space, and reports the cost of each remap.  The time spent on
+ * a config space write that does not touch the memory map is subtracted,
+ * so that the figures show the memory_region_transaction_commit() cost
+ * rather than the qtest round trip.  It also reports how many FlatViews
+ * each remap rendered and how many it reused.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define FIRST_SLOT  3
+#define LAST_SLOT   31
+
+/* pci-testdev BAR 0: test selector, and data byte of the selected test */
+#define TESTDEV_TEST        0
+#define TESTDEV_DATA        8
+#define TESTDEV_DATAMATCH   0xfa
+
+typedef struct BenchArgs {
+    int ndevs;
+    int nremaps;
+} BenchArgs;
+
+static int devfn_of(int i)
+{
+    return QPCI_DEVFN(FIRST_SLOT + i / 8, i % 8);
+}
+
+static QTestState *bench_start(int ndevs)
+{
+    GString *cmd = g_string_new("-nodefaults -machine pc");
+    QTestState *qts;
+    int i;
+
+    for (i = 0; i < ndevs; i++) {
+        int devfn = devfn_of(i);
+
+        g_string_append_printf(cmd, " -device pci-testdev,addr=%02x.%x"
+                               ",multifunction=on",
+                               PCI_SLOT(devfn), PCI_FUNC(devfn));
+    }
+    qts = qtest_init(cmd->str);
+    g_string_free(cmd, true);
+    return qts;
+}
+
+/* Read the FlatView update totals from "info mtree -f" */
+static void bench_flatview_updates(QTestState *qts, uint64_t *rendered,
+                                   uint64_t *reused)
+{
+    g_autofree char *mtree = qtest_hmp(qts, "info mtree -f");
+    const char *line = strstr(mtree, "FlatView updates: ");
+
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "FlatView updates: %" SCNu64 " rendered, %"
+                           SCNu64 " reused", rendered, reused), ==, 2);
+}
+
+static double bench_config_writes(QPCIDevice *dev, uint8_t offset,
+                                  const uint32_t *values, int n)
+{
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        qpci_config_writel(dev, offset, values[i & 1]);
+    }
+    return g_test_timer_elapsed() * 1e6 / n;
+}
+
+static void test_commit_bench(const void *opaque)
+{
+    const BenchArgs *args = opaque;
+    QTestState *qts = bench_start(args->ndevs);
+    QPCIBus *bus = qpci_new_pc(qts, NULL);
+    QPCIDevice **devs = g_new0(QPCIDevice *, args->ndevs);
+    uint32_t bars[2], nop[2];
+    QPCIBar new_bar, old_bar;
+    uint64_t rendered[2], reused[2];
+    double remap_us, nop_us;
+    int i;
+
+    for (i = 0; i < args->ndevs; i++) {
+        devs[i] = qpci_device_find(bus, devfn_of(i));
+        g_assert(devs[i]);
+        qpci_device_enable(devs[i]);
+        qpci_iomap(devs[i], 0, NULL);
+    }
+
+    /* Alternate BAR 0 of the first device with a free, aligned address */
+    bars[0] = qpci_config_readl(devs[0], PCI_BASE_ADDRESS_0);
+    bars[1] = QEMU_ALIGN_UP(bus->mmio_alloc_ptr, 0x10000);
+    g_assert_cmpuint(bars[1] + 0x10000, <=, bus->mmio_limit);
+
+    /* Cache line size and latency timer do not affect the memory map */
+    nop[0] = nop[1] = qpci_config_readl(devs[0], PCI_CACHE_LINE_SIZE);
+
+    nop_us = bench_config_writes(devs[0], PCI_CACHE_LINE_SIZE, nop,
+                                 args->nremaps);
+    bench_flatview_updates(qts, &rendered[0], &reused[0]);
+    remap_us = bench_config_writes(devs[0], PCI_BASE_ADDRESS_0, bars,
+                                   args->nremaps);
+    bench_flatview_updates(qts, &rendered[1], &reused[1]);
+
+    g_test_message("%d devices: %.1f us per BAR remap, %.1f us per plain "
+                   "config write, commit cost %.1f us",
+                   args->ndevs, remap_us, nop_us, MAX(remap_us - nop_us, 0));
+    g_test_message("%d devices: %.1f FlatViews rendered and %.1f reused "
+                   "per BAR remap", args->ndevs,
+                   (double)(rendered[1] - rendered[0]) / args->nremaps,
+                   (double)(reused[1] - reused[0]) / args->nremaps);
+    /* Every remap changes system memory, whose view must be rendered */
+    g_assert_cmpuint(rendered[1] - rendered[0], >=, args->nremaps);
+
+    /* The BAR must have taken the last value written */
+    new_bar.addr = bars[(args->nremaps - 1) & 1] & PCI_BASE_ADDRESS_MEM_MASK;
+    new_bar.is_io = false;
+    old_bar.addr = bars[args->nremaps & 1] & PCI_BASE_ADDRESS_MEM_MASK;
+    old_bar.is_io = false;
+    g_assert_cmphex(qpci_config_readl(devs[0], PCI_BASE_ADDRESS_0) &
+                    PCI_BASE_ADDRESS_MEM_MASK, ==, new_bar.addr);
+
+    /* ... and the memory map must follow: the device answers there only */
+    qpci_io_writeb(devs[0], new_bar, TESTDEV_TEST, 0);
+    g_assert_cmphex(qpci_io_readb(devs[0], new_bar, TESTDEV_DATA), ==,
+                    TESTDEV_DATAMATCH);
+    g_assert_cmphex(qpci_io_readb(devs[0], old_bar, TESTDEV_DATA), !=,
+                    TESTDEV_DATAMATCH);
+
+    for (i = 0; i < args->ndevs; i++) {
+        g_free(devs[i]);
+    }
+    g_free(devs);
+    qpci_free_pc(bus);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    static const int quick_devs[] = { 1, 16, 64 };
+    static const int slow_devs[] = { 128, (LAST_SLOT - FIRST_SLOT + 1) * 8 };
+    int nremaps;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    nremaps = g_test_slow() ? 2000 : 50;
+
+    for (i = 0; i < ARRAY_SIZE(quick_devs); i++) {
+        BenchArgs *args = g_new(BenchArgs, 1);
+        g_autofree char *path = g_strdup_printf("/memory/commit-bench/%d",
+                                                quick_devs[i]);
+
+        args->ndevs = quick_devs[i];
+        args->nremaps = nremaps;
+        qtest_add_data_func_full(path, args, test_commit_bench, g_free);
+    }
+    if (g_test_slow()) {
+        for (i = 0; i < ARRAY_SIZE(slow_devs); i++) {
+            BenchArgs *args = g_new(BenchArgs, 1);
+            g_autofree char *path = g_strdup_printf("/memory/commit-bench/%d",
+                                                    slow_devs[i]);
+
+            args->ndevs = slow_devs[i];
+            args->nremaps = nremaps;
+            qtest_add_data_func_full(path, args, test_commit_bench, g_free);
+        }
+    }
+
+    return g_test_run();
+}
@@ -19,6 +19,7 @@
 
 #define TEST_IMAGE_SIZE         (64 * 1024 * 1024)
 #define QVIRTIO_BLK_TIMEOUT_US  (30 * 1000 * 1000)
+#define COALESCE_USECS          1000
 #define PCI_SLOT_HP             0x06
 
 typedef struct QVirtioBlkReq {
@@ -771,6 +772,83 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/* Submit a one sector read and return the address of the request */
+static uint64_t coalesce_read(QVirtioDevice *dev, QGuestAllocator *alloc,
+                              QVirtQueue *vq)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    QTestState *qts = global_qtest;
+
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    return req_addr;
+}
+
+/*
+ * With irq-coalesce-usecs set, the interrupt for a completion is held
+ * back, but must still arrive once the delay has passed, or at the
+ * latest when the VM stops.
+ */
+static void coalesce(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    uint64_t features;
+    uint64_t req_addr;
+    uint32_t desc_idx;
+    uint8_t status;
+    QVirtQueue *vq;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+
+    qvirtio_set_driver_ok(dev);
+
+    /* Signalled once the delay has passed */
+    req_addr = coalesce_read(dev, t_alloc, vq);
+    status = qvirtio_wait_status_byte_no_isr(qts, dev, vq, req_addr + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    qtest_clock_step(qts, COALESCE_USECS * 1000);
+    g_assert(dev->bus->get_queue_isr_status(dev, vq));
+    g_assert(qvirtqueue_get_buf(qts, vq, &desc_idx, NULL));
+    guest_free(t_alloc, req_addr);
+
+    /* Signalled when the VM stops, while the virtual clock stands still */
+    req_addr = coalesce_read(dev, t_alloc, vq);
+    status = qvirtio_wait_status_byte_no_isr(qts, dev, vq, req_addr + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    qtest_qmp_assert_success(qts, "{ 'execute': 'stop' }");
+    g_assert(dev->bus->get_queue_isr_status(dev, vq));
+    g_assert(qvirtqueue_get_buf(qts, vq, &desc_idx, NULL));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    guest_free(t_alloc, req_addr);
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -796,6 +874,19 @@ static void register_virtio_blk_test(void)
     qos_add_test("basic", "virtio-blk", basic, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
 
+    opts.edge.extra_device_opts = "irq-coalesce-usecs="
+                                  stringify(COALESCE_USECS)
+                                  ",irq-coalesce-adaptive=off";
+    qos_add_test("coalesce", "virtio-blk", coalesce, &opts);
+
+    /* A single frame per interrupt means no delay at all */
+    opts.edge.extra_device_opts = "irq-coalesce-usecs="
+                                  stringify(COALESCE_USECS)
+                                  ",irq-coalesce-adaptive=off"
+                                  ",irq-coalesce-frames=1";
+    qos_add_test("coalesce-frames-1", "virtio-blk", basic, &opts);
+    opts.edge.extra_device_opts = NULL;
+
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
     qos_add_test("idx", "virtio-blk-pci", idx, &opts);
@@ -0,0 +1,363 @@
+/*
+ * QTest throughput benchmark for the virtqueue layouts
+ *
+ * Reads from a null block device through virtio-blk with split rings,
+ * packed rings, and packed rings with VIRTIO_F_IN_ORDER.  Requests are
+ * submitted in batches with a single notification each; the number of
+ * used ring entries the device wrote is reported next to the request
+ * rate, which shows the effect of in-order batching.  Run with -m slow
+ * for meaningful numbers.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+#include "qemu/bswap.h"
+#include "qemu/module.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "libqos/qgraph.h"
+#include "libqos/virtio-blk.h"
+
+#define BENCH_TIMEOUT_US        (30 * 1000 * 1000)
+#define BENCH_DEPTH             32
+#define BENCH_DATA_SIZE         4096
+#define BENCH_DESCS_PER_REQ     3
+#define BENCH_REQ_SIZE          (16 + BENCH_DATA_SIZE + 1)
+#define BENCH_STATUS_OFFSET     (16 + BENCH_DATA_SIZE)
+
+typedef enum {
+    BENCH_SPLIT,
+    BENCH_PACKED,
+    BENCH_PACKED_IN_ORDER,
+} BenchLayout;
+
+static BenchLayout layouts[] = {
+    BENCH_SPLIT, BENCH_PACKED, BENCH_PACKED_IN_ORDER,
+};
+
+static const char *layout_names[] = {
+    [BENCH_SPLIT] = "split",
+    [BENCH_PACKED] = "packed",
+    [BENCH_PACKED_IN_ORDER] = "packed-in-order",
+};
+
+typedef struct BenchRing {
+    QTestState *qts;
+    QVirtioDevice *dev;
+    QVirtQueue *vq;
+    BenchLayout layout;
+    uint64_t req_addr[BENCH_DEPTH];
+
+    /* Driver side ring state */
+    uint16_t avail_idx;
+    bool avail_wrap;
+    uint16_t used_idx;
+    bool used_wrap;
+
+    /* Requests completed and used entries seen in the current batch */
+    unsigned int done;
+    uint64_t used_entries;
+} BenchRing;
+
+/* Ring memory is little endian with VIRTIO 1.0 */
+static uint16_t bench_readw(BenchRing *r, uint64_t addr)
+{
+    uint16_t val;
+
+    qtest_memread(r->qts, addr, &val, sizeof(val));
+    return le16_to_cpu(val);
+}
+
+static void bench_writew(BenchRing *r, uint64_t addr, uint16_t val)
+{
+    val = cpu_to_le16(val);
+    qtest_memwrite(r->qts, addr, &val, sizeof(val));
+}
+
+static void bench_write_desc(BenchRing *r, uint16_t pos, uint64_t addr,
+                             uint32_t len, uint16_t id, uint16_t flags)
+{
+    struct vring_packed_desc desc = {
+        .addr = cpu_to_le64(addr),
+        .len = cpu_to_le32(len),
+        .id = cpu_to_le16(id),
+        .flags = cpu_to_le16(flags),
+    };
+
+    qtest_memwrite(r->qts, r->vq->desc + pos * sizeof(desc),
+                   &desc, sizeof(desc));
+}
+
+static void bench_kick(BenchRing *r)
+{
+    uint16_t flags;
+
+    /* The device event suppression structure lives in the used area */
+    flags = bench_readw(r, r->vq->used + (r->layout == BENCH_SPLIT ? 0 : 2));
+    if (r->layout == BENCH_SPLIT ? !(flags & VRING_USED_F_NO_NOTIFY)
+                                 : flags != VRING_PACKED_EVENT_FLAG_DISABLE) {
+        r->dev->bus->virtqueue_kick(r->dev, r->vq);
+    }
+}
+
+/* The split ring chains never change, only the avail ring is written */
+static void bench_split_init(BenchRing *r)
+{
+    struct vring_desc desc;
+    unsigned int i, d;
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        for (d = 0; d < BENCH_DESCS_PER_REQ; d++) {
+            uint16_t pos = i * BENCH_DESCS_PER_REQ + d;
+
+            desc.addr = cpu_to_le64(r->req_addr[i] +
+                                    (d == 0 ? 0 :
+                                     d == 1 ? 16 : BENCH_STATUS_OFFSET));
+            desc.len = cpu_to_le32(d == 0 ? 16 :
+                                   d == 1 ? BENCH_DATA_SIZE : 1);
+            desc.flags = cpu_to_le16((d ? VRING_DESC_F_WRITE : 0) |
+                                     (d < 2 ? VRING_DESC_F_NEXT : 0));
+            desc.next = cpu_to_le16(pos + 1);
+            qtest_memwrite(r->qts, r->vq->desc + pos * sizeof(desc),
+                           &desc, sizeof(desc));
+        }
+    }
+}
+
+static void bench_split_submit(BenchRing *r)
+{
+    unsigned int i;
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        uint16_t slot = (r->avail_idx + i) % r->vq->size;
+
+        bench_writew(r, r->vq->avail + 4 + slot * 2, i * BENCH_DESCS_PER_REQ);
+    }
+
+    /* A single index update publishes the whole batch */
+    r->avail_idx += BENCH_DEPTH;
+    bench_writew(r, r->vq->avail + 2, r->avail_idx);
+    bench_kick(r);
+}
+
+static void bench_split_complete(BenchRing *r)
+{
+    uint16_t idx = bench_readw(r, r->vq->used + 2);
+
+    while (r->used_idx != idx) {
+        r->used_idx++;
+        r->used_entries++;
+        r->done++;
+    }
+}
+
+static void bench_packed_submit(BenchRing *r)
+{
+    uint16_t first = r->avail_idx;
+    uint16_t first_flags = 0;
+    unsigned int i, d;
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        for (d = 0; d < BENCH_DESCS_PER_REQ; d++) {
+            uint16_t flags = (d ? VRING_DESC_F_WRITE : 0) |
+                             (d < 2 ? VRING_DESC_F_NEXT : 0);
+
+            if (r->avail_wrap) {
+                flags |= 1 << VRING_PACKED_DESC_F_AVAIL;
+            } else {
+                flags |= 1 << VRING_PACKED_DESC_F_USED;
+            }
+
+            if (r->avail_idx == first && !first_flags) {
+                /* Make the batch visible only once it is complete */
+                first_flags = flags;
+                flags = r->avail_wrap ? 1 << VRING_PACKED_DESC_F_USED
+                                      : 1 << VRING_PACKED_DESC_F_AVAIL;
+            }
+            bench_write_desc(r, r->avail_idx,
+                             r->req_addr[i] +
+                             (d == 0 ? 0 : d == 1 ? 16 : BENCH_STATUS_OFFSET),
+                             d == 0 ? 16 : d == 1 ? BENCH_DATA_SIZE : 1,
+                             i, flags);
+            if (++r->avail_idx == r->vq->size) {
+                r->avail_idx = 0;
+                r->avail_wrap = !r->avail_wrap;
+            }
+        }
+    }
+
+    bench_writew(r, r->vq->desc + first * 16 + 14, first_flags);
+    bench_kick(r);
+}
+
+static void bench_packed_complete(BenchRing *r)
+{
+    for (;;) {
+        uint64_t addr = r->vq->desc + r->used_idx * 16;
+        uint16_t flags = bench_readw(r, addr + 14);
+        bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+        bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+        unsigned int id, n;
+
+        if (avail != used || used != r->used_wrap) {
+            return;
+        }
+
+        id = bench_readw(r, addr + 12);
+        g_assert_cmpuint(id, <, BENCH_DEPTH);
+
+        /*
+         * With in-order, buffers are used in the order they were made
+         * available and buffer id i is the i-th request of the batch; a
+         * single used descriptor may stand for several of them.
+         */
+        if (r->layout == BENCH_PACKED_IN_ORDER) {
+            g_assert_cmpuint(id, >=, r->done);
+            n = id + 1 - r->done;
+        } else {
+            n = 1;
+        }
+        r->done += n;
+        r->used_entries++;
+
+        r->used_idx += n * BENCH_DESCS_PER_REQ;
+        if (r->used_idx >= r->vq->size) {
+            r->used_idx -= r->vq->size;
+            r->used_wrap = !r->used_wrap;
+        }
+    }
+}
+
+static void bench_batch(BenchRing *r)
+{
+    gint64 deadline = g_get_monotonic_time() + BENCH_TIMEOUT_US;
+    unsigned int i;
+
+    r->done = 0;
+    if (r->layout == BENCH_SPLIT) {
+        bench_split_submit(r);
+    } else {
+        bench_packed_submit(r);
+    }
+
+    for (;;) {
+        if (r->layout == BENCH_SPLIT) {
+            bench_split_complete(r);
+        } else {
+            bench_packed_complete(r);
+        }
+        if (r->done == BENCH_DEPTH) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < deadline);
+        qtest_clock_step(r->qts, 100);
+    }
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        uint64_t status = r->req_addr[i] + BENCH_STATUS_OFFSET;
+
+        g_assert_cmpint(qtest_readb(r->qts, status), ==, VIRTIO_BLK_S_OK);
+        qtest_writeb(r->qts, status, 0xff);
+    }
+}
+
+static void ring_bench(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    BenchLayout layout = *(BenchLayout *)data;
+    BenchRing r = {
+        .qts = global_qtest,
+        .dev = &blk->pci_vdev.vdev,
+        .layout = layout,
+        .avail_wrap = true,
+        .used_wrap = true,
+    };
+    unsigned int i, batches = g_test_slow() ? 4096 : 16;
+    uint64_t features;
+    gint64 start, elapsed;
+
+    features = qvirtio_get_features(r.dev);
+    if (!(features & (1ull << VIRTIO_F_VERSION_1))) {
+        g_test_skip("VIRTIO 1.0 transport required");
+        return;
+    }
+    if (layout != BENCH_SPLIT) {
+        g_assert(features & (1ull << VIRTIO_F_RING_PACKED));
+    }
+    if (layout == BENCH_PACKED_IN_ORDER) {
+        g_assert(features & (1ull << VIRTIO_F_IN_ORDER));
+    }
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX) |
+                  (1ull << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(r.dev, features);
+
+    r.vq = qvirtqueue_setup(r.dev, alloc, 0);
+    g_assert_cmpuint(r.vq->size, >=, BENCH_DEPTH * BENCH_DESCS_PER_REQ);
+    qvirtio_set_driver_ok(r.dev);
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        struct virtio_blk_outhdr hdr = {
+            .type = cpu_to_le32(VIRTIO_BLK_T_IN),
+            .sector = cpu_to_le64(i * (BENCH_DATA_SIZE / 512)),
+        };
+
+        r.req_addr[i] = guest_alloc(alloc, BENCH_REQ_SIZE);
+        qtest_memwrite(r.qts, r.req_addr[i], &hdr, sizeof(hdr));
+        qtest_writeb(r.qts, r.req_addr[i] + BENCH_STATUS_OFFSET, 0xff);
+    }
+    if (layout == BENCH_SPLIT) {
+        bench_split_init(&r);
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < batches; i++) {
+        bench_batch(&r);
+    }
+    elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    g_test_message("%s: %u requests in %" PRId64 " us, %.0f requests/s, "
+                   "%.2f used entries per request",
+                   layout_names[layout], batches * BENCH_DEPTH, elapsed,
+                   batches * BENCH_DEPTH * 1e6 / elapsed,
+                   (double)r.used_entries / (batches * BENCH_DEPTH));
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        guest_free(alloc, r.req_addr[i]);
+    }
+    qvirtqueue_cleanup(r.dev->bus, r.vq, alloc);
+}
+
+static void *virtio_ring_bench_setup(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -drive if=none,id=drive0,file=null-co://,"
+                    "file.read-zeroes=on,format=raw ");
+    return arg;
+}
+
+static void register_virtio_ring_bench(void)
+{
+    QOSGraphTestOptions opts = {
+        .before = virtio_ring_bench_setup,
+    };
+
+    opts.arg = &layouts[BENCH_SPLIT];
+    qos_add_test("ring-bench/split", "virtio-blk-pci", ring_bench, &opts);
+
+    opts.edge.extra_device_opts = "packed=on";
+    opts.arg = &layouts[BENCH_PACKED];
+    qos_add_test("ring-bench/packed", "virtio-blk-pci", ring_bench, &opts);
+
+    opts.edge.extra_device_opts = "packed=on,in_order=on";
+    opts.arg = &layouts[BENCH_PACKED_IN_ORDER];
+    qos_add_test("ring-bench/packed-in-order", "virtio-blk-pci",
+                 ring_bench, &opts);
+}
+
+libqos_init(register_virtio_ring_bench);
@@ -0,0 +1,190 @@
+/*
+ * Check io_uring passthrough (-io-uring): NOP and READV requests, and
+ * rings that the guest creates disabled and enables itself.
+ *
+ * Without passthrough, or where it is not possible, io_uring_setup
+ * fails with ENOSYS and the test is skipped.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+
+struct ring {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+};
+
+static int ring_setup(struct ring *r, unsigned flags)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    r->fd = syscall(__NR_io_uring_setup, 4, &p);
+    if (r->fd < 0) {
+        return -errno;
+    }
+
+    sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned),
+              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              r->fd, IORING_OFF_SQ_RING);
+    assert(sq != MAP_FAILED);
+    cq = mmap(NULL, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe),
+              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              r->fd, IORING_OFF_CQ_RING);
+    assert(cq != MAP_FAILED);
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    assert(r->sqes != MAP_FAILED);
+
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+
+    r->sq_array[idx] = idx;
+    memset(&r->sqes[idx], 0, sizeof(r->sqes[idx]));
+    return &r->sqes[idx];
+}
+
+/* Submit the prepared SQE and return the result of its completion. */
+static int ring_submit_wait(struct ring *r, __u64 user_data)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+    ret = syscall(__NR_io_uring_enter, r->fd, 1, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0) {
+        return -errno;
+    }
+    assert(ret == 1);
+
+    head = *r->cq_head;
+    assert(__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) != head);
+    cqe = &r->cqes[head & *r->cq_mask];
+    assert(cqe->user_data == user_data);
+    ret = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static void test_nop(struct ring *r)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(r);
+
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = 1;
+    assert(ring_submit_wait(r, 1) == 0);
+}
+
+static void test_readv(struct ring *r)
+{
+    static const char msg[] = "hello";
+    char buf[sizeof(msg)] = "";
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    struct io_uring_sqe *sqe;
+    int fds[2];
+
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], msg, sizeof(msg)) == sizeof(msg));
+
+    sqe = ring_get_sqe(r);
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fds[0];
+    sqe->addr = (unsigned long)&iov;
+    sqe->len = 1;
+    sqe->user_data = 2;
+    assert(ring_submit_wait(r, 2) == sizeof(msg));
+    assert(memcmp(buf, msg, sizeof(msg)) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_disabled(void)
+{
+    struct io_uring_sqe *sqe;
+    struct ring r;
+    int ret;
+
+    ret = ring_setup(&r, IORING_SETUP_R_DISABLED);
+    if (ret == -EINVAL) {
+        printf("SKIP: disabled rings not supported by the kernel\n");
+        return;
+    }
+    assert(ret == 0);
+
+    /* The ring must stay disabled until the guest enables it. */
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = 3;
+    assert(ring_submit_wait(&r, 3) == -EBADFD);
+    *r.sq_tail -= 1;
+
+    assert(syscall(__NR_io_uring_register, r.fd,
+                   IORING_REGISTER_ENABLE_RINGS, NULL, 0) == 0);
+    test_nop(&r);
+    close(r.fd);
+}
+
+int main(void)
+{
+    struct ring r;
+    int ret;
+
+    ret = ring_setup(&r, 0);
+    if (ret == -ENOSYS) {
+        printf("SKIP: io_uring not available\n");
+        return 0;
+    }
+    assert(ret == 0);
+
+    test_nop(&r);
+    test_readv(&r);
+    close(r.fd);
+
+    test_disabled();
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("SKIP: io_uring not supported by the toolchain\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Cost of syscalls whose arguments go through guest structures.
+ *
+ * ioctl arguments are described to linux-user as thunk types, and stat
+ * results are written into guest structures.  When guest and host lay
+ * these out the same way no conversion is needed; this reports the time
+ * per call so that the difference can be measured.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERS 20000
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *name, int64_t start)
+{
+    printf("%-12s %6lld ns/call\n", name,
+           (long long)(now_ns() - start) / ITERS);
+}
+
+static void bench_fionread(void)
+{
+    int fds[2], avail, i;
+    int64_t start;
+
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "x", 1) == 1);
+
+    start = now_ns();
+    for (i = 0; i < ITERS; i++) {
+        assert(ioctl(fds[0], FIONREAD, &avail) == 0);
+        assert(avail == 1);
+    }
+    report("FIONREAD", start);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void bench_winsize(void)
+{
+    struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+    int fd, i;
+    int64_t start;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        printf("%-12s skipped, no pty\n", "TIOCGWINSZ");
+        return;
+    }
+    assert(ioctl(fd, TIOCSWINSZ, &ws) == 0);
+
+    start = now_ns();
+    for (i = 0; i < ITERS; i++) {
+        assert(ioctl(fd, TIOCGWINSZ, &ws) == 0);
+        assert(ws.ws_row == 24 && ws.ws_col == 80);
+    }
+    report("TIOCGWINSZ", start);
+
+    close(fd);
+}
+
+static void bench_stat(const char *path)
+{
+    struct stat st;
+    int i;
+    int64_t start;
+
+    start = now_ns();
+    for (i = 0; i < ITERS; i++) {
+        assert(stat(path, &st) == 0);
+    }
+    report("stat", start);
+}
+
+static void bench_statx(const char *path)
+{
+    struct statx stx;
+    int i;
+    int64_t start;
+
+    if (statx(AT_FDCWD, path, 0, STATX_BASIC_STATS, &stx) != 0) {
+        printf("%-12s skipped, not supported\n", "statx");
+        return;
+    }
+
+    start = now_ns();
+    for (i = 0; i < ITERS; i++) {
+        assert(statx(AT_FDCWD, path, 0, STATX_BASIC_STATS, &stx) == 0);
+        assert(S_ISDIR(stx.stx_mode));
+    }
+    report("statx", start);
+}
+
+int main(void)
+{
+    bench_fionread();
+    bench_winsize();
+    bench_stat("/");
+    bench_statx("/");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*
+ * Scalability of mmap/munmap and code execution across guest threads.
+ *
+ * Every thread repeatedly maps a page, copies a function into it, calls
+ * it and unmaps the page again, while also running shared code and
+ * making syscalls that check guest buffers.  This exercises translation,
+ * page flag updates and page flag lookups concurrently.  The time taken
+ * is reported for increasing numbers of threads; with good scaling it
+ * should stay roughly flat.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nop_func.h"
+
+#define ITERS       500
+#define MAX_THREADS 64
+#define BUF_SIZE    1024
+
+static uint32_t checksum(const uint8_t *buf, size_t len)
+{
+    uint32_t a = 1, b = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        a = (a + buf[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static uint32_t expected;
+
+static void *thread_fn(void *arg)
+{
+    uint8_t buf[BUF_SIZE];
+    char cwd[256];
+    size_t page_size = getpagesize();
+    int i;
+
+    memset(buf, (uintptr_t)arg, sizeof(buf));
+    for (i = 0; i < ITERS; i++) {
+        char *p = mmap(NULL, page_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        int ret;
+
+        assert(p != MAP_FAILED);
+        memcpy(p, nop_func, sizeof(nop_func));
+        ((void(*)(void))p)();
+        ret = munmap(p, page_size);
+        assert(ret == 0);
+
+        assert(getcwd(cwd, sizeof(cwd)) != NULL);
+        memset(buf, 0x5a, sizeof(buf));
+        assert(checksum(buf, sizeof(buf)) == expected);
+    }
+    return NULL;
+}
+
+static double run(int n_threads)
+{
+    pthread_t threads[MAX_THREADS];
+    struct timespec t0, t1;
+    int i, ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n_threads; i++) {
+        ret = pthread_create(&threads[i], NULL, thread_fn,
+                             (void *)(uintptr_t)i);
+        assert(ret == 0);
+    }
+    for (i = 0; i < n_threads; i++) {
+        ret = pthread_join(threads[i], NULL);
+        assert(ret == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t buf[BUF_SIZE];
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    int n;
+
+    /* Without a template, nothing to test. */
+    if (sizeof(nop_func) == 0) {
+        return EXIT_SUCCESS;
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+        fprintf(stderr, "thread count must be between 1 and %d\n",
+                MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+
+    memset(buf, 0x5a, sizeof(buf));
+    expected = checksum(buf, sizeof(buf));
+
+    for (n = 1; n <= max_threads; n *= 2) {
+        double t = run(n);
+
+        printf("%2d threads: %.3f s, %.0f iterations/s\n",
+               n, t, n * ITERS / t);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/*
+ * Vectorised kernels, timed and checked against scalar code.
+ *
+ * Each kernel is strip-mined with vsetvli, so all but the last iteration
+ * run with vl == VLMAX; compare the reported times with and without
+ * inline expansion of RVV loads, stores and arithmetic.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define N     4099
+#define ITERS 2000
+
+static uint8_t src8[N], dst8[N];
+static uint32_t a32[N], b32[N], c32[N];
+static uint64_t a64[N], b64[N];
+
+static void vec_memcpy(uint8_t *d, const uint8_t *s, size_t n)
+{
+    size_t vl;
+
+    for (; n > 0; n -= vl, s += vl, d += vl) {
+        asm volatile("vsetvli %0, %1, e8, m1, ta, ma\n\t"
+                     "vle8.v v8, (%2)\n\t"
+                     "vse8.v v8, (%3)"
+                     : "=&r"(vl) : "r"(n), "r"(s), "r"(d) : "memory");
+    }
+}
+
+static void vec_add32(uint32_t *c, const uint32_t *a, const uint32_t *b,
+                      size_t n)
+{
+    size_t vl;
+
+    for (; n > 0; n -= vl, a += vl, b += vl, c += vl) {
+        asm volatile("vsetvli %0, %1, e32, m1, ta, ma\n\t"
+                     "vle32.v v8, (%2)\n\t"
+                     "vle32.v v9, (%3)\n\t"
+                     "vadd.vv v8, v8, v9\n\t"
+                     "vse32.v v8, (%4)"
+                     : "=&r"(vl) : "r"(n), "r"(a), "r"(b), "r"(c)
+                     : "memory");
+    }
+}
+
+/* c = a * k + c */
+static void vec_axpy32(uint32_t *c, const uint32_t *a, uint32_t k, size_t n)
+{
+    size_t vl;
+
+    for (; n > 0; n -= vl, a += vl, c += vl) {
+        asm volatile("vsetvli %0, %1, e32, m2, ta, ma\n\t"
+                     "vle32.v v8, (%2)\n\t"
+                     "vle32.v v10, (%3)\n\t"
+                     "vmul.vx v8, v8, %4\n\t"
+                     "vadd.vv v8, v8, v10\n\t"
+                     "vse32.v v8, (%3)"
+                     : "=&r"(vl) : "r"(n), "r"(a), "r"(c), "r"(k)
+                     : "memory");
+    }
+}
+
+static void vec_xor64(uint64_t *b, const uint64_t *a, size_t n)
+{
+    size_t vl;
+
+    for (; n > 0; n -= vl, a += vl, b += vl) {
+        asm volatile("vsetvli %0, %1, e64, m1, ta, ma\n\t"
+                     "vle64.v v8, (%2)\n\t"
+                     "vle64.v v9, (%3)\n\t"
+                     "vxor.vv v8, v8, v9\n\t"
+                     "vsll.vi v8, v8, 1\n\t"
+                     "vse64.v v8, (%3)"
+                     : "=&r"(vl) : "r"(n), "r"(a), "r"(b) : "memory");
+    }
+}
+
+/* Whole register moves, independent of vl. */
+static void vec_copy_whole(uint8_t *d, const uint8_t *s, size_t n)
+{
+    size_t vlenb;
+
+    asm("csrr %0, vlenb" : "=r"(vlenb));
+    for (; n >= vlenb; n -= vlenb, s += vlenb, d += vlenb) {
+        asm volatile("vl1re8.v v8, (%0)\n\t"
+                     "vs1r.v v8, (%1)"
+                     : : "r"(s), "r"(d) : "memory");
+    }
+    memcpy(d, s, n);
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *name, int64_t t, size_t elems)
+{
+    printf("%-12s %8.2f ns/element\n", name,
+           (double)t / ((double)elems * ITERS));
+}
+
+int main(void)
+{
+    int64_t t;
+    int i, j, err = 0;
+
+    for (i = 0; i < N; i++) {
+        src8[i] = i * 7;
+        a32[i] = i * 3;
+        b32[i] = i ^ 0x5555;
+        a64[i] = (uint64_t)i << 33 | i;
+    }
+
+    t = now_ns();
+    for (j = 0; j < ITERS; j++) {
+        vec_memcpy(dst8, src8, N);
+    }
+    report("memcpy", now_ns() - t, N);
+    err |= memcmp(dst8, src8, N) != 0;
+
+    memset(dst8, 0, N);
+    t = now_ns();
+    for (j = 0; j < ITERS; j++) {
+        vec_copy_whole(dst8, src8, N);
+    }
+    report("copy-whole", now_ns() - t, N);
+    err |= memcmp(dst8, src8, N) != 0;
+
+    t = now_ns();
+    for (j = 0; j < ITERS; j++) {
+        vec_add32(c32, a32, b32, N);
+    }
+    report("add32", now_ns() - t, N);
+    for (i = 0; i < N; i++) {
+        err |= c32[i] != a32[i] + b32[i];
+    }
+
+    memset(c32, 0, sizeof(c32));
+    t = now_ns();
+    for (j = 0; j < ITERS; j++) {
+        vec_axpy32(c32, a32, 5, N);
+    }
+    report("axpy32", now_ns() - t, N);
+    for (i = 0; i < N; i++) {
+        err |= c32[i] != a32[i] * 5 * ITERS;
+    }
+
+    memset(b64, 0, sizeof(b64));
+    t = now_ns();
+    for (j = 0; j < ITERS; j++) {
+        vec_xor64(b64, a64, N);
+    }
+    report("xor64", now_ns() - t, N);
+    for (i = 0; i < N; i++) {
+        uint64_t x = 0;
+
+        for (j = 0; j < ITERS; j++) {
+            x = (x ^ a64[i]) << 1;
+        }
+        err |= b64[i] != x;
+    }
+
+    if (err) {
+        printf("FAIL: vector result mismatch\n");
+        return 1;
+    }
+    return 0;
+}